@@ -24,14 +24,28 @@
 #include <string.h>
 
 #include "at.h"
-#include "shell.h"
 #include "timex.h"
+#include "xtimer.h"
 
 #include "periph/uart.h"
 
-static at_dev_t at_dev;
-static char buf[256];
-static char resp[1024];
+#include "sim7020.h"
+
+#ifdef MODULE_SHELL
+#include "shell.h"
+#endif
+
+#ifdef MODULE_SIM7020_SHELL
+/* Device selected with the 'dev' command */
+sim7020_t *sim7020cmd_dev(void);
+#endif
+
+#ifdef MODULE_SIM7020_DEBUG
+/* The generic AT commands work on the selected SIM7020 device */
+static inline sim7020_t *_dev(void)
+{
+    return sim7020cmd_dev();
+}
 
 static int init(int argc, char **argv)
 {
@@ -46,7 +60,7 @@ static int init(int argc, char **argv)
     uint8_t uart = atoi(argv[1]);
     uint32_t baudrate = atoi(argv[2]);
 
-    int res = at_dev_init(&at_dev, UART_DEV(uart), baudrate, buf, sizeof(buf));
+    int res = at_dev_init(&_dev()->at_dev, UART_DEV(uart), baudrate, _dev()->buf, sizeof(_dev()->buf));
 
     /* check the UART initialization return value and respond as needed */
     if (res == UART_NODEV) {
@@ -69,12 +83,12 @@ static int send(int argc, char **argv)
     }
 
     ssize_t len;
-    if ((len = at_send_cmd_get_resp(&at_dev, argv[1], resp, sizeof(resp), 10 * US_PER_SEC)) < 0) {
+    if ((len = at_send_cmd_get_resp(&_dev()->at_dev, argv[1], _dev()->resp, sizeof(_dev()->resp), 10 * US_PER_SEC)) < 0) {
         puts("Error");
         return 1;
     }
 
-    printf("Response (len=%d): %s\n", (int)len, resp);
+    printf("Response (len=%d): %s\n", (int)len, _dev()->resp);
 
     return 0;
 }
@@ -86,7 +100,7 @@ static int send_ok(int argc, char **argv)
         return 1;
     }
 
-    if (at_send_cmd_wait_ok(&at_dev, argv[1], 10 * US_PER_SEC) < 0) {
+    if (at_send_cmd_wait_ok(&_dev()->at_dev, argv[1], 10 * US_PER_SEC) < 0) {
         puts("Error");
         return 1;
     }
@@ -104,12 +118,12 @@ static int send_lines(int argc, char **argv)
     }
 
     ssize_t len;
-    if ((len = at_send_cmd_get_lines(&at_dev, argv[1], resp, sizeof(resp), true, 10 * US_PER_SEC)) < 0) {
+    if ((len = at_send_cmd_get_lines(&_dev()->at_dev, argv[1], _dev()->resp, sizeof(_dev()->resp), true, 10 * US_PER_SEC)) < 0) {
         puts("Error");
         return 1;
     }
 
-    printf("Response (len=%d): %s\n", (int)len, resp);
+    printf("Response (len=%d): %s\n", (int)len, _dev()->resp);
 
     return 0;
 }
@@ -124,9 +138,9 @@ static int send_recv_bytes(int argc, char **argv)
     }
 
     sprintf(buffer, "%s%s", argv[1], AT_SEND_EOL);
-    at_send_bytes(&at_dev, buffer, strlen(buffer));
+    at_send_bytes(&_dev()->at_dev, buffer, strlen(buffer));
 
-    ssize_t len = at_recv_bytes(&at_dev, buffer, atoi(argv[2]), 10 * US_PER_SEC);
+    ssize_t len = at_recv_bytes(&_dev()->at_dev, buffer, atoi(argv[2]), 10 * US_PER_SEC);
 
     printf("Response (len=%d): %s\n", (int)len, buffer);
 
@@ -146,10 +160,10 @@ static int send_recv_bytes_until_string(int argc, char **argv)
     }
 
     sprintf(buffer, "%s%s", argv[1], AT_SEND_EOL);
-    at_send_bytes(&at_dev, buffer, strlen(buffer));
+    at_send_bytes(&_dev()->at_dev, buffer, strlen(buffer));
     memset(buffer, 0, sizeof(buffer));
 
-    int res = at_recv_bytes_until_string(&at_dev, argv[2], buffer, &len,
+    int res = at_recv_bytes_until_string(&_dev()->at_dev, argv[2], buffer, &len,
                                          10 * US_PER_SEC);
 
     if (res) {
@@ -166,7 +180,7 @@ static int drain(int argc, char **argv)
     (void)argc;
     (void)argv;
 
-    at_drain(&at_dev);
+    at_drain(&_dev()->at_dev);
 
     return 0;
 }
@@ -176,7 +190,7 @@ static int power_on(int argc, char **argv)
     (void)argc;
     (void)argv;
 
-    at_dev_poweron(&at_dev);
+    at_dev_poweron(&_dev()->at_dev);
 
     puts("Powered on");
 
@@ -188,7 +202,7 @@ static int power_off(int argc, char **argv)
     (void)argc;
     (void)argv;
 
-    at_dev_poweroff(&at_dev);
+    at_dev_poweroff(&_dev()->at_dev);
 
     puts("Powered off");
 
@@ -233,7 +247,7 @@ static int add_urc(int argc, char **argv)
             urc_list[i].arg = NULL;
             urc_list[i].cb = _urc_cb;
             urc_used[i] = true;
-            at_add_urc(&at_dev, &urc_list[i]);
+            at_add_urc(&_dev()->at_dev, &urc_list[i]);
             puts("urc registered");
             return 0;
         }
@@ -251,7 +265,7 @@ static int process_urc(int argc, char **argv)
     }
 
     uint32_t timeout = strtoul(argv[1], NULL, 0);
-    at_process_urc(&at_dev, timeout);
+    at_process_urc(&_dev()->at_dev, timeout);
 
     puts("urc processed");
 
@@ -267,7 +281,7 @@ static int remove_urc(int argc, char **argv)
 
     for (size_t i = 0; i < MAX_URC_NB; i++) {
         if (urc_used[i] && strcmp(urc_list[i].code, argv[1]) == 0) {
-            at_remove_urc(&at_dev, &urc_list[i]);
+            at_remove_urc(&_dev()->at_dev, &urc_list[i]);
             urc_used[i] = false;
             puts("urc removed");
             return 0;
@@ -278,21 +292,37 @@ static int remove_urc(int argc, char **argv)
     return 1;
 }
 #endif
+#endif /* MODULE_SIM7020_DEBUG */
 
-#define SIM7020
-#ifdef SIM7020
+#ifdef MODULE_SIM7020_SHELL
+int sim7020cmd_dev_select(int argc, char **argv);
 int sim7020cmd_init(int argc, char **argv);
 int sim7020cmd_register(int argc, char **argv);
+int sim7020cmd_conf(int argc, char **argv);
 int sim7020cmd_activate(int argc, char **argv);
 int sim7020cmd_status(int argc, char **argv);
 int sim7020cmd_udp_socket(int argc, char **argv);
 int sim7020cmd_close(int argc, char **argv);
 int sim7020cmd_connect(int argc, char **argv);
 int sim7020cmd_send(int argc, char **argv);
+int sim7020cmd_qsend(int argc, char **argv);
+int sim7020cmd_queue(int argc, char **argv);
 int sim7020cmd_test(int argc, char **argv);
 int sim7020cmd_recv(int arg, char **argv);
-#endif /* SIM7020 */
+int sim7020cmd_log(int argc, char **argv);
+int sim7020cmd_mp(int argc, char **argv);
+int sim7020cmd_enc_send(int argc, char **argv);
+int sim7020cmd_enc_bench(int argc, char **argv);
+int sim7020cmd_dtls_connect(int argc, char **argv);
+int sim7020cmd_dtls_send(int argc, char **argv);
+int sim7020cmd_dtls_renew(int argc, char **argv);
+int sim7020cmd_dtls_close(int argc, char **argv);
+int sim7020cmd_trace(int argc, char **argv);
+#endif /* MODULE_SIM7020_SHELL */
+
+#ifdef MODULE_SHELL
 static const shell_command_t shell_commands[] = {
+#ifdef MODULE_SIM7020_DEBUG
     { "initdev", "Initialize AT device", init },
     { "send", "Send a command and wait response", send },
     { "send_ok", "Send a command and wait OK", send_ok },
@@ -308,19 +338,49 @@ static const shell_command_t shell_commands[] = {
     { "remove_urc", "De-register an URC", remove_urc },
     { "process_urc", "Process the URCs", process_urc },
 #endif
-#ifdef SIM7020
+#endif /* MODULE_SIM7020_DEBUG */
+#ifdef MODULE_SIM7020_SHELL
+    { "dev", "Select SIM7020 device", sim7020cmd_dev_select },
     { "init", "Init SIM7020", sim7020cmd_init },
     { "register", "Register SIM7020", sim7020cmd_register },
     { "reg", "Register SIM7020", sim7020cmd_register },
+    { "conf", "Show/set SIM7020 operator, APN and bands", sim7020cmd_conf },
     { "act", "Activate SIM7020", sim7020cmd_activate },    
+#ifdef MODULE_SIM7020_STATUS
     { "status", "Report SIM7020 status", sim7020cmd_status },
+#endif
     { "usock", "Create SIM7020 UDP socket", sim7020cmd_udp_socket },        
     { "ucon", "Connect SIM7020 socket", sim7020cmd_connect },
     { "usend", "Send on SIM7020 socket", sim7020cmd_send },
+#ifdef MODULE_SIM7020_QUEUE
+    { "qsend", "Queue for sending on SIM7020 queue channel", sim7020cmd_qsend },
+    { "queue", "Report SIM7020 send queue, or set channel socket", sim7020cmd_queue },
+#endif
     { "uclose", "Close SIM7020 socket", sim7020cmd_close },
+#ifdef MODULE_SIM7020_RECV
     { "urecv", "Recv on SIM7020 socket", sim7020cmd_recv },
+#endif
+#ifdef MODULE_SIM7020_DEBUG
     { "utest", "repeat usend", sim7020cmd_test },                
-#endif /* SIM7020 */
+#endif
+#ifdef MODULE_SIM7020_DTLS
+    { "dcon", "DTLS connect on SIM7020 socket", sim7020cmd_dtls_connect },
+    { "dsend", "DTLS send on SIM7020 socket", sim7020cmd_dtls_send },
+    { "drenew", "DTLS new handshake", sim7020cmd_dtls_renew },
+    { "dclose", "DTLS close", sim7020cmd_dtls_close },
+#endif
+#ifdef MODULE_SIM7020_ENC
+    { "esend", "Send compressed on SIM7020 socket", sim7020cmd_enc_send },
+    { "encbench", "Benchmark SIM7020 payload encoding", sim7020cmd_enc_bench },
+#endif
+#ifdef MODULE_SIM7020_MP
+    { "mp", "Multipath send over SIM7020 devices", sim7020cmd_mp },
+#endif
+    { "log", "Show/set SIM7020 log levels", sim7020cmd_log },
+#ifdef MODULE_SIM7020_TRACE
+    { "trace", "Dump SIM7020 trace", sim7020cmd_trace },
+#endif
+#endif /* MODULE_SIM7020_SHELL */
 
     { NULL, NULL, NULL },
 };
@@ -334,3 +394,42 @@ int main(void)
     shell_run(shell_commands, line_buf, SHELL_DEFAULT_BUFSIZE);
     return 0;
 }
+#else /* MODULE_SHELL */
+
+/* Transmit-only image: send a sequence number periodically */
+#ifndef SIM7020_SERVER_ADDR
+#define SIM7020_SERVER_ADDR "192.0.2.1"
+#endif
+#ifndef SIM7020_SERVER_PORT
+#define SIM7020_SERVER_PORT 5683
+#endif
+#ifndef SIM7020_SEND_INTERVAL
+#define SIM7020_SEND_INTERVAL 60
+#endif
+
+static sim7020_t sim7020_dev;
+static sim7020_conf_t sim7020_conf = SIM7020_CONF_DEFAULT;
+
+int main(void)
+{
+    char data[16];
+    unsigned int seq = 0;
+    int sockid;
+
+    sim7020_setup(&sim7020_dev, 0);
+    sim7020_init(&sim7020_dev, 1, 9600, &sim7020_conf);
+    sim7020_register(&sim7020_dev, &sim7020_conf);
+    sim7020_activate(&sim7020_dev);
+    while ((sockid = sim7020_udp_socket(&sim7020_dev)) < 0)
+        xtimer_sleep(5);
+    sim7020_connect(&sim7020_dev, sockid, SIM7020_SERVER_ADDR, SIM7020_SERVER_PORT);
+
+    while (1) {
+        int len = snprintf(data, sizeof(data), "%u", seq++);
+        if (sim7020_send(&sim7020_dev, sockid, (uint8_t *) data, len) < 0)
+            puts("Send failed");
+        xtimer_sleep(SIM7020_SEND_INTERVAL);
+    }
+    return 0;
+}
+#endif /* MODULE_SHELL */
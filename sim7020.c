@@ -9,181 +9,371 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <errno.h>
+#include <stdatomic.h>
 
 #include "at.h"
+#include "irq.h"
+#include "msg.h"
 #include "xtimer.h"
 #include "periph/uart.h"
+#ifdef MODULE_PERIPH_FLASHPAGE_RAW
+#include "periph/flashpage.h"
+#endif
 
-static at_dev_t at_dev;
-static char buf[256];
-static char resp[1024];
+#include "sim7020.h"
+#include "sim7020_log.h"
 
- mutex_t sim7020_lock = MUTEX_INIT;
+/* No of registration polls (5 s apart) on the last known band
+ * before falling back to the configured band list */
+#ifndef SIM7020_LAST_CELL_POLLS
+#define SIM7020_LAST_CELL_POLLS 24
+#endif
 
-int sim7020_init(uint8_t uart, uint32_t baudrate) {
+/*
+ * Last successful cell and band. Kept in flash, one page per device
+ * counting down from SIM7020_CELL_FLASHPAGE, so that registration
+ * after a reboot can start on a known band instead of scanning all
+ * of them. The pages are erased by the driver, so they must be
+ * reserved for it -- there is no default, set SIM7020_CELL_FLASHPAGE
+ * in the Makefile to enable.
+ */
+#if defined(MODULE_PERIPH_FLASHPAGE_RAW) && defined(SIM7020_CELL_FLASHPAGE)
+#define SIM7020_CELL_FLASH
+#define CELL_PAGE(dev) (SIM7020_CELL_FLASHPAGE - (dev)->num)
+#endif
+
+static void _load_cell(sim7020_t *dev) {
+  memset(&dev->last_cell, 0, sizeof(dev->last_cell));
+#ifdef SIM7020_CELL_FLASH
+  memcpy(&dev->last_cell, flashpage_addr(CELL_PAGE(dev)), sizeof(dev->last_cell));
+#endif
+  if (dev->last_cell.magic != SIM7020_CELL_MAGIC || dev->last_cell.band == 0)
+    memset(&dev->last_cell, 0, sizeof(dev->last_cell));
+}
 
-    int res = at_dev_init(&at_dev, UART_DEV(uart), baudrate, buf, sizeof(buf));
+static void _store_cell(sim7020_t *dev) {
+#ifdef SIM7020_CELL_FLASH
+  /* Erase page, then write record */
+  flashpage_write(CELL_PAGE(dev), NULL);
+  if (dev->last_cell.magic == SIM7020_CELL_MAGIC)
+    flashpage_write_raw(flashpage_addr(CELL_PAGE(dev)), &dev->last_cell, sizeof(dev->last_cell));
+#else
+  (void) dev;
+#endif
+}
+
+int sim7020_last_cell(sim7020_t *dev, sim7020_cell_t *cell) {
+  if (dev->last_cell.magic != SIM7020_CELL_MAGIC)
+    return -1;
+  *cell = dev->last_cell;
+  return 0;
+}
+
+void sim7020_forget_cell(sim7020_t *dev) {
+  memset(&dev->last_cell, 0, sizeof(dev->last_cell));
+  _store_cell(dev);
+}
+
+/* Lowest downlink EARFCN for each band (3GPP TS 36.101) */
+static const struct {
+  uint8_t band;
+  uint32_t earfcn;
+} band_earfcn[] = {
+  {1, 0}, {2, 600}, {3, 1200}, {5, 2400}, {8, 3450}, {12, 5010},
+  {13, 5180}, {17, 5730}, {18, 5850}, {19, 6000}, {20, 6150},
+  {25, 8040}, {26, 8690}, {28, 9210}, {66, 66436}, {70, 68336},
+  {71, 68586}, {85, 70366},
+};
+
+static uint8_t _earfcn_to_band(uint32_t earfcn) {
+  uint8_t band = 0;
+
+  for (unsigned int i = 0; i < sizeof(band_earfcn)/sizeof(band_earfcn[0]); i++) {
+    if (earfcn >= band_earfcn[i].earfcn)
+      band = band_earfcn[i].band;
+  }
+  return band;
+}
+
+/* Remember serving cell and band after successful registration */
+static void _save_cell(sim7020_t *dev, const sim7020_conf_t *conf) {
+  int res;
+  unsigned long earfcn, cellid;
+
+  res = at_send_cmd_wait_ok(&dev->at_dev, "AT+CENG=0", 60*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev, "AT+CENG?", dev->resp, sizeof(dev->resp), 60*1000000);
+  if (res <= 0)
+    return;
+  if (2 != sscanf(dev->resp, "+CENG: %lu,%*d,%*d,\"%lx\"", &earfcn, &cellid))
+    return;
+  uint8_t band = _earfcn_to_band(earfcn);
+  if (band == 0)
+    return;
+  if (dev->last_cell.magic == SIM7020_CELL_MAGIC && dev->last_cell.band == band && dev->last_cell.cellid == cellid
+      && strncmp(dev->last_cell.operator, conf->operator, sizeof(dev->last_cell.operator)) == 0)
+    return; /* Unchanged, spare the flash */
+  dev->last_cell.magic = SIM7020_CELL_MAGIC;
+  dev->last_cell.band = band;
+  dev->last_cell.cellid = cellid;
+  strncpy(dev->last_cell.operator, conf->operator, sizeof(dev->last_cell.operator));
+  dev->last_cell.operator[sizeof(dev->last_cell.operator)-1] = '\0';
+  _store_cell(dev);
+  SIM7020_LOG(DRV, INFO, "Saved cell %lx band %d\n", cellid, band);
+}
+
+#define BANDS_CMD_LEN 80
+
+/*
+ * Band setting command for a band list. No list means all bands the
+ * modem supports, as reported by AT+CBAND=? -- variants differ (the
+ * SIM7020E has 1,3,5,8,20,28), and a band it lacks fails the command.
+ */
+static int _bands_cmd(sim7020_t *dev, const uint8_t *bands, uint8_t nbands, char *cmd, size_t size) {
+  char list[64];
+  int pos;
+
+  if (nbands == 0) {
+    int res = at_send_cmd_get_resp(&dev->at_dev, "AT+CBAND=?", dev->resp, sizeof(dev->resp), 5000000);
+    if (res <= 0 || 1 != sscanf(dev->resp, "+CBAND: (%63[0-9,])", list)) {
+      SIM7020_LOG(DRV, ERROR, "Cannot read supported bands: '%s'\n", res > 0 ? dev->resp : "");
+      return -1;
+    }
+    snprintf(cmd, size, "AT+CBAND=%s", list);
+    return 0;
+  }
+  pos = snprintf(cmd, size, "AT+CBAND=");
+  for (uint8_t i = 0; i < nbands && pos < (int) size; i++)
+    pos += snprintf(cmd + pos, size - pos, "%s%d", i ? "," : "", bands[i]);
+  return 0;
+}
+
+/* Limit bands to speed up network search */
+static int _set_bands(sim7020_t *dev, const char *cmd) {
+  int res = at_send_cmd_wait_ok(&dev->at_dev, cmd, 5000000);
+
+  if (res < 0)
+    SIM7020_LOG(DRV, ERROR, "%s failed: %d\n", cmd, res);
+  return res;
+}
+
+static int _select_operator(sim7020_t *dev, const sim7020_conf_t *conf) {
+  char cmd[32];
+
+  if (conf->opsel == SIM7020_OPSEL_AUTO)
+    return at_send_cmd_wait_ok(&dev->at_dev, "AT+COPS=0", 120*1000000);
+  snprintf(cmd, sizeof(cmd), "AT+COPS=%d,2,\"%s\"", conf->opsel, conf->operator);
+  return at_send_cmd_wait_ok(&dev->at_dev, cmd, 120*1000000);
+}
+
+void sim7020_setup(sim7020_t *dev, uint8_t num) {
+  mutex_init(&dev->lock);
+  dev->num = num;
+#ifdef MODULE_SIM7020_RECV
+  atomic_init(&dev->recv_wr, 0);
+  atomic_init(&dev->recv_rd, 0);
+  dev->recv_pid = KERNEL_PID_UNDEF;
+  dev->recv_dropped = 0;
+#endif
+}
+
+int sim7020_init(sim7020_t *dev, uint8_t uart, uint32_t baudrate, const sim7020_conf_t *conf) {
+
+    /* The receive thread may be running -- keep it out while the AT
+     * device is reset */
+    mutex_lock(&dev->lock);
+    int res = at_dev_init(&dev->at_dev, UART_DEV(uart), baudrate, dev->buf, sizeof(dev->buf));
+    mutex_unlock(&dev->lock);
 
     if (res != UART_OK) {
-      printf("Error initialising AT dev %d speed %d\n", uart, baudrate);
+      SIM7020_LOG(DRV, ERROR, "Error initialising AT dev %d speed %lu\n", uart, (unsigned long) baudrate);
       return 1;
     }
+    dev->uart = uart;
+    dev->sockets = 0;                   /* Modem reset closes them */
+    dev->conf = conf;
+    _load_cell(dev);
+    SIM7020_TRACE(DRV, INIT, uart);
 
-    res = at_send_cmd_wait_ok(&at_dev, "AT+RESET", 5000000);
+    res = at_send_cmd_wait_ok(&dev->at_dev, "AT+RESET", 5000000);
     /* Ignore */
-    res = at_send_cmd_wait_ok(&at_dev, "AT", 5000000);
+    res = at_send_cmd_wait_ok(&dev->at_dev, "AT", 5000000);
     if (res < 0)
-      printf("AT fail\n");
-    res = at_send_cmd_wait_ok(&at_dev, "AT+CPSMS=0", 5000000);
+      SIM7020_LOG(DRV, ERROR, "AT fail\n");
+    res = at_send_cmd_wait_ok(&dev->at_dev, "AT+CPSMS=0", 5000000);
     if (res < 0)
-      printf("CPSMS fail\n");      
-
-    /* Limit bands to speed up roaming */
-    /* WIP needs a generic solution */
-    //res = at_send_cmd_wait_ok(&at_dev, "AT+CBAND=20", 5000000);
-
-    /* Receive data as hex string */
-    res = at_send_cmd_wait_ok(&at_dev, "AT+CSORCVFLAG=0", 5000000);
+      SIM7020_LOG(DRV, WARNING, "CPSMS fail\n");      
 
 #define SIM7020_RECVHEX
 #ifdef SIM7020_RECVHEX
     /* Receive data as hex string */
-    res = at_send_cmd_wait_ok(&at_dev, "AT+CSORCVFLAG=0", 5000000);
+    res = at_send_cmd_wait_ok(&dev->at_dev, "AT+CSORCVFLAG=0", 5000000);
 #else  
     /* Receive binary data */
-    res = at_send_cmd_wait_ok(&at_dev, "AT+CSORCVFLAG=1", 5000000);
+    res = at_send_cmd_wait_ok(&dev->at_dev, "AT+CSORCVFLAG=1", 5000000);
 #endif /* SIM7020_RECVHEX */
 
-    //Telia is 24001
-    //res = at_send_cmd_wait_ok(&at_dev, "AT+COPS=1,2,\"24002\"", 5000000);
-
     /* Signal Quality Report */
-    res = at_send_cmd_get_resp(&at_dev, "AT+CSQ", resp, sizeof(resp), 10*1000000);
+    res = at_send_cmd_get_resp(&dev->at_dev, "AT+CSQ", dev->resp, sizeof(dev->resp), 10*1000000);
 
     return res;
 }
-/* Operator MCCMNC (mobile country code and mobile network code) */
-/* Telia */
-//#define OPERATOR "24001"
-//#define APN "lpwa.telia.iot"
-/* 3  */
-#define OPERATOR "24002"
-#define APN "internet"
-
-int sim7020_register(void) {
-  int res;
 
-  while (0) {
-    /* Request list of network operators */
-    res = at_send_cmd_get_resp(&at_dev, "AT+COPS=?", resp, sizeof(resp), 120*1000000);
-    if (res > 0) {
-      if (strncmp(resp, "+COPS", strlen("+COPS")) == 0)
-        break;
-    }
-    xtimer_sleep(5);
-  }
+/* 1 (Registered, home network) or 5 (Registered, roaming) */
+static int _registered(sim7020_t *dev) {
+  int res = at_send_cmd_get_resp(&dev->at_dev, "AT+CREG?", dev->resp, sizeof(dev->resp), 120*1000000);
+  uint8_t creg;
 
-  //res =at_send_cmd_wait_ok(&at_dev, "AT+COPS=1,2,\"24001\"", 120*1000000);
+  if (res > 0 && 1 == (sscanf(dev->resp, "%*[^:]: %*d,%hhd", &creg)))
+    return creg == 1 || creg == 5;
+  return 0;
+}
 
+int sim7020_registered(sim7020_t *dev) {
+  mutex_lock(&dev->lock);
+  int res = _registered(dev);
+  mutex_unlock(&dev->lock);
+  return res;
+}
+
+int sim7020_register(sim7020_t *dev, const sim7020_conf_t *conf) {
+  int res;
   int count = 0;
+  int lastpolls = 0;
+  char bands_cmd[BANDS_CMD_LEN];        /* Configured bands */
+  int have_bands;
+
+  dev->conf = conf;
+
+  /* Only lock to the last band if we know how to undo it */
+  have_bands = _bands_cmd(dev, conf->bands, conf->nbands, bands_cmd, sizeof(bands_cmd)) == 0;
+
+  /* Start on the band of the last successful attach, if it was
+   * with the same operator */
+  if (have_bands && dev->last_cell.magic == SIM7020_CELL_MAGIC &&
+      (conf->opsel == SIM7020_OPSEL_AUTO ||
+       strncmp(dev->last_cell.operator, conf->operator, sizeof(dev->last_cell.operator)) == 0)) {
+    char cmd[16];
+
+    SIM7020_LOG(DRV, INFO, "Trying last band %d\n", dev->last_cell.band);
+    snprintf(cmd, sizeof(cmd), "AT+CBAND=%d", dev->last_cell.band);
+    if (_set_bands(dev, cmd) == 0)
+      lastpolls = SIM7020_LAST_CELL_POLLS;
+    else
+      _set_bands(dev, bands_cmd);
+  }
+  else if (have_bands)
+    _set_bands(dev, bands_cmd);
+
   while (1) {
 
     if (count++ % 8 == 0) {
-      res =at_send_cmd_wait_ok(&at_dev, "AT+COPS=1,2,\"" OPERATOR "\"", 120*1000000);
+      res = _select_operator(dev, conf);
+      if (res < 0)
+        SIM7020_LOG(DRV, WARNING, "Operator selection failed: %d\n", res);
     }
       
-    res = at_send_cmd_get_resp(&at_dev, "AT+CREG?", resp, sizeof(resp), 120*1000000);
-    if (res > 0) {
-      uint8_t creg;
-
-      if (1 == (sscanf(resp, "%*[^:]: %*d,%hhd", &creg))) {
-        /* Wait for 1 (Registered, home network) or 5 (Registered, roaming) */
-        if (creg == 1 || creg == 5)
-          break;
-      }
+    if (_registered(dev))
+      break;
+    if (lastpolls > 0 && --lastpolls == 0) {
+      /* No luck with last band -- search all configured bands */
+      SIM7020_LOG(DRV, INFO, "Last band failed, trying all\n");
+      if (_set_bands(dev, bands_cmd) < 0)
+        lastpolls = 1;                  /* Still locked, try again */
+      count = 0;
     }
     xtimer_sleep(5);
 
   }
 
+  /* Attached on the last band -- open up the configured bands again,
+   * so the modem can move to another cell when this one degrades */
+  if (lastpolls > 0)
+    _set_bands(dev, bands_cmd);
+  _save_cell(dev, conf);
+  SIM7020_TRACE(DRV, REG, dev->last_cell.band);
   return 1;
 }
 
-int sim7020_activate(void) {
+int sim7020_activate(sim7020_t *dev) {
   int res;
   uint8_t attempts = 3;
+  char cmd[96];
   
-  res = at_send_cmd_get_resp(&at_dev,"AT+CSTT?", resp, sizeof(resp), 120*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev,"AT+CSTT?", dev->resp, sizeof(dev->resp), 120*1000000);
   if (res > 0) {
-    if (strncmp("+CSTT: \"\"", resp, sizeof("+CSTT: \"\"")-1) != 0)
+    if (strncmp("+CSTT: \"\"", dev->resp, sizeof("+CSTT: \"\"")-1) != 0)
       return 0;
   }
   /* Start Task and Set APN, USER NAME, PASSWORD */
-  //res = at_send_cmd_get_resp(&at_dev,"AT+CSTT=\"lpwa.telia.iot\",\"\",\"\"", resp, sizeof(resp), 120*1000000);
-  res = at_send_cmd_get_resp(&at_dev,"AT+CSTT=\"" APN "\",\"\",\"\"", resp, sizeof(resp), 120*1000000);  
+  snprintf(cmd, sizeof(cmd), "AT+CSTT=\"%s\",\"%s\",\"%s\"",
+           dev->conf->apn, dev->conf->user, dev->conf->password);
+  res = at_send_cmd_get_resp(&dev->at_dev, cmd, dev->resp, sizeof(dev->resp), 120*1000000);  
   while (attempts--) {
     /* Bring Up Wireless Connection with GPRS or CSD */
-    res = at_send_cmd_wait_ok(&at_dev, "AT+CIICR", 600*1000000);
+    res = at_send_cmd_wait_ok(&dev->at_dev, "AT+CIICR", 600*1000000);
     if (res == 0) {
-      printf("activated\n");
+      SIM7020_LOG(DRV, INFO, "activated\n");
       break;
     }
     xtimer_sleep(8);
   }
+  SIM7020_TRACE(DRV, ACT, res);
   return res == 0;
 }
 
-int sim7020_status(void) {
+#ifdef MODULE_SIM7020_STATUS
+int sim7020_status(sim7020_t *dev) {
   int res;
 
   if (1) {
-    printf("Searching for operators, be patient\n");
-    res = at_send_cmd_get_resp(&at_dev, "AT+COPS=?", resp, sizeof(resp), 120*1000000);
+    SIM7020_LOG(DRV, INFO, "Searching for operators, be patient\n");
+    res = at_send_cmd_get_resp(&dev->at_dev, "AT+COPS=?", dev->resp, sizeof(dev->resp), 120*1000000);
   }
-  res = at_send_cmd_get_resp(&at_dev, "AT+CREG?", resp, sizeof(resp), 120*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev, "AT+CREG?", dev->resp, sizeof(dev->resp), 120*1000000);
   /* Request International Mobile Subscriber Identity */
-  res = at_send_cmd_get_resp(&at_dev, "AT+CIMI", resp, sizeof(resp), 10*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev, "AT+CIMI", dev->resp, sizeof(dev->resp), 10*1000000);
 
     /* Request TA Serial Number Identification (IMEI) */
-  res = at_send_cmd_get_resp(&at_dev, "AT+GSN", resp, sizeof(resp), 10*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev, "AT+GSN", dev->resp, sizeof(dev->resp), 10*1000000);
 
   /* Mode 0: Radio information for serving and neighbor cells */
-  res = at_send_cmd_wait_ok(&at_dev,"AT+CENG=0", 60*1000000);
+  res = at_send_cmd_wait_ok(&dev->at_dev,"AT+CENG=0", 60*1000000);
   /* Report Network State */
-  res = at_send_cmd_get_resp(&at_dev,"AT+CENG?", resp, sizeof(resp), 60*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev,"AT+CENG?", dev->resp, sizeof(dev->resp), 60*1000000);
 
   /* Signal Quality Report */
-  res = at_send_cmd_wait_ok(&at_dev,"AT+CSQ", 60*1000000);
+  res = at_send_cmd_wait_ok(&dev->at_dev,"AT+CSQ", 60*1000000);
   /* Task status, APN */
-  res = at_send_cmd_get_resp(&at_dev,"AT+CSTT?", resp, sizeof(resp), 60*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev,"AT+CSTT?", dev->resp, sizeof(dev->resp), 60*1000000);
 
   /* Get Local IP Address */
-  res = at_send_cmd_get_resp(&at_dev,"AT+CIFSR", resp, sizeof(resp), 60*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev,"AT+CIFSR", dev->resp, sizeof(dev->resp), 60*1000000);
   /* PDP Context Read Dynamic Parameters */
-  res = at_send_cmd_get_resp(&at_dev,"AT+CGCONTRDP", resp, sizeof(resp), 60*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev,"AT+CGCONTRDP", dev->resp, sizeof(dev->resp), 60*1000000);
   return res;
 }
+#endif /* MODULE_SIM7020_STATUS */
 
-int sim7020_udp_socket(void) {
+int sim7020_udp_socket(sim7020_t *dev) {
   int res;
   /* Create a socket: IPv4, UDP, 1 */
-  res = at_send_cmd_get_resp(&at_dev, "AT+CSOC=1,2,1", resp, sizeof(resp), 120*1000000);    
+  res = at_send_cmd_get_resp(&dev->at_dev, "AT+CSOC=1,2,1", dev->resp, sizeof(dev->resp), 120*1000000);    
     if (res > 0) {
       uint8_t sockid;
 
-      if (1 == (sscanf(resp, "+CSOC: %hhd", &sockid))) {
+      if (1 == (sscanf(dev->resp, "+CSOC: %hhd", &sockid))) {
         return sockid;
       }
       else
-        printf("Parse error: '%s'\n", resp);
+        SIM7020_LOG(DRV, ERROR, "Parse error: '%s'\n", dev->resp);
     }
     else
-      at_drain(&at_dev);
+      at_drain(&dev->at_dev);
     return res;
 }
 
-int sim7020_close(uint8_t sockid) {
+int sim7020_close(sim7020_t *dev, uint8_t sockid) {
 
   int res;
   char cmd[64];
@@ -191,12 +381,14 @@ int sim7020_close(uint8_t sockid) {
 
   sprintf(cmd, "AT+CSOCL=%d", sockid);
 
-  res = at_send_cmd_wait_ok(&at_dev, cmd, 120*1000000);
+  res = at_send_cmd_wait_ok(&dev->at_dev, cmd, 120*1000000);
+  if (sockid < 8)
+    dev->sockets &= ~(1 << sockid);
   return res;
 }
 
 
-int sim7020_connect(uint8_t sockid, char *ipaddr, uint16_t port) {
+int sim7020_connect(sim7020_t *dev, uint8_t sockid, char *ipaddr, uint16_t port) {
 
   int res;
   char cmd[64];
@@ -205,38 +397,45 @@ int sim7020_connect(uint8_t sockid, char *ipaddr, uint16_t port) {
           sockid, port, ipaddr);
 
   /* Create a socket: IPv4, UDP, 1 */
-  res = at_send_cmd_get_resp(&at_dev, cmd, resp, sizeof(resp), 120*1000000);
+  res = at_send_cmd_get_resp(&dev->at_dev, cmd, dev->resp, sizeof(dev->resp), 120*1000000);
+  if (res > 0 && strncmp(dev->resp, "ERROR", 5) != 0 && sockid < 8)
+    dev->sockets |= 1 << sockid;
   return res;
 }
 
+int sim7020_socket_connected(sim7020_t *dev, uint8_t sockid) {
+  return sockid < 8 && (dev->sockets & (1 << sockid));
+}
+
 
-#define AT_RADIO_MAX_SEND_LEN 128
-int sim7020_send(uint8_t sockid, uint8_t *data, size_t datalen) {
+int sim7020_send(sim7020_t *dev, uint8_t sockid, uint8_t *data, size_t datalen) {
   int res;
 
   size_t len = (datalen < AT_RADIO_MAX_SEND_LEN ? datalen : AT_RADIO_MAX_SEND_LEN);
   char cmd[32];
 
 
-  mutex_lock(&sim7020_lock);
-  at_drain(&at_dev);
+  mutex_lock(&dev->lock);
+  at_drain(&dev->at_dev);
   snprintf(cmd, sizeof(cmd), "AT+CSODSEND=%d,%d", sockid, len);
-  res = at_send_cmd(&at_dev, cmd, 10*1000000);
-  res = at_expect_bytes(&at_dev, "> ", 10*1000000);
+  res = at_send_cmd(&dev->at_dev, cmd, 10*1000000);
+  res = at_expect_bytes(&dev->at_dev, "> ", 10*1000000);
   if (res != 0) {
-    printf("No send prompt\n");
+    SIM7020_LOG(SEND, WARNING, "No send prompt\n");
     goto out;
   }
   if (res == 0) {
-    at_send_bytes(&at_dev, (char *) data, len);
+    at_send_bytes(&dev->at_dev, (char *) data, len);
     while (1) {
       unsigned int nsent;
-      res = at_readline(&at_dev, resp, sizeof(resp), 0, 10*1000000);
+      res = at_readline(&dev->at_dev, dev->resp, sizeof(dev->resp), 0, 10*1000000);
       if (res < 0) {
-        printf("Timeout waiting for DATA ACCEPT confirmation\n");
+        SIM7020_LOG(SEND, WARNING, "Timeout waiting for DATA ACCEPT confirmation\n");
         goto out;
       }
-      if (1 == (sscanf(resp, "DATA ACCEPT: %d", &nsent))) {
+      if (1 == (sscanf(dev->resp, "DATA ACCEPT: %d", &nsent))) {
+        SIM7020_LOG(SEND, DEBUG, "Sent %u bytes on sockid %d\n", nsent, sockid);
+        SIM7020_TRACE(SEND, SEND, nsent);
         res = nsent;
         goto out;
       }
@@ -244,71 +443,140 @@ int sim7020_send(uint8_t sockid, uint8_t *data, size_t datalen) {
   }
   res = 0;
  out:
-  mutex_unlock(&sim7020_lock);
+  if (res < 0)
+    SIM7020_TRACE(SEND, SEND_FAIL, res);
+  mutex_unlock(&dev->lock);
   return res;
 }
 
-static uint8_t recv_buf[AT_RADIO_MAX_RECV_LEN];
+#ifdef MODULE_SIM7020_RECV
+/*
+ * Single-producer/single-consumer ring for received datagrams. The
+ * URC callback (producer) runs in the receive thread with the modem
+ * locked, so it only decodes into the ring and notifies the consumer.
+ * Indices run freely and are masked on access; each is written by one
+ * side only, so no lock is needed.
+ *
+ * Record: length (2 bytes, little endian), socket id, data.
+ */
+#define RECV_HDR_LEN 3
+#define RECV_RING_MASK (SIM7020_RECV_RING_SIZE - 1)
+
+#if (SIM7020_RECV_RING_SIZE & RECV_RING_MASK) != 0
+#error "SIM7020_RECV_RING_SIZE must be a power of two"
+#endif
+
+static uint8_t _hexval(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  return (c | 0x20) - 'a' + 10;
+}
 
 static void _recv_cb(void *arg, const char *code) {
-  (void) arg;
+  sim7020_t *dev = arg;
   int sockid, len;
-  printf("recv_cb for code '%s'\n", code);
   int res = sscanf(code, "+CSONMI: %d,%d,", &sockid, &len);
-  if (res == 2) {
-    printf("GOt %d bytes on sockid %d\n", len, sockid);
-    /* Data is encoded as hex string, so
-     * data length is half the string length */ 
-
-    int rcvlen = len >> 1;
-
-    if (rcvlen >  AT_RADIO_MAX_RECV_LEN)
-      return; /* Too large */
-    /* Find first char after second comma */
-    char *ptr = strchr(strchr(code, ',')+1, ',')+1;
-    
-    for (int i = 0; i < rcvlen; i++) {
-      char hexstr[3];
-      hexstr[0] = *ptr++; hexstr[1] = *ptr++; hexstr[2] = '\0';
-      printf("hexstr %d: '%s' ", i, hexstr);
-      recv_buf[i] = (uint8_t) strtoul(hexstr, NULL, 16);
-      printf("-> %d\n", recv_buf[i]);
-    }
-    for (int i = 0; i < rcvlen; i++) {
-      if (isprint(recv_buf[i]))
-        putchar(recv_buf[i]);
-      else
-        printf("0x%02x", recv_buf[i]);
-      putchar(' ');
-    }
-    putchar('\n');
+  if (res != 2) {
+    SIM7020_LOG(RECV, WARNING, "recv_cb parse error '%s'\n", code);
+    return;
+  }
+  /* Data is encoded as hex string, so
+   * data length is half the string length */ 
+  uint16_t rcvlen = len >> 1;
+
+  /* Find first char after second comma */
+  const char *ptr = strchr(code, ',');
+  if (ptr != NULL)
+    ptr = strchr(ptr + 1, ',');
+  if (ptr == NULL || len < 0) {
+    SIM7020_LOG(RECV, WARNING, "recv_cb parse error '%s'\n", code);
+    return;
+  }
+  ptr++;
+  if (strlen(ptr) < 2 * (size_t) rcvlen)
+    return; /* Truncated */
+
+  uint16_t wr = atomic_load_explicit(&dev->recv_wr, memory_order_relaxed);
+  uint16_t rd = atomic_load_explicit(&dev->recv_rd, memory_order_acquire);
+  if (rcvlen > AT_RADIO_MAX_RECV_LEN ||
+      (uint16_t) (SIM7020_RECV_RING_SIZE - (uint16_t) (wr - rd)) < RECV_HDR_LEN + rcvlen) {
+    dev->recv_dropped++; /* Too large, or consumer too slow */
+    SIM7020_TRACE(RECV, RECV_DROP, rcvlen);
+    return;
   }
+  dev->recv_ring[wr++ & RECV_RING_MASK] = rcvlen & 0xff;
+  dev->recv_ring[wr++ & RECV_RING_MASK] = rcvlen >> 8;
+  dev->recv_ring[wr++ & RECV_RING_MASK] = sockid;
+  for (uint16_t i = 0; i < rcvlen; i++, ptr += 2)
+    dev->recv_ring[wr++ & RECV_RING_MASK] = (_hexval(ptr[0]) << 4) | _hexval(ptr[1]);
+  atomic_store_explicit(&dev->recv_wr, wr, memory_order_release);
+  SIM7020_LOG(RECV, DEBUG, "Got %u bytes on sockid %d\n", rcvlen, sockid);
+  SIM7020_TRACE(RECV, RECV, rcvlen);
+
+  kernel_pid_t pid = dev->recv_pid;
+  if (pid != KERNEL_PID_UNDEF) {
+    msg_t m = { .type = SIM7020_MSG_RECV, .content.ptr = dev };
+    msg_try_send(&m, pid);
+  }
+}
+
+int sim7020_recv_notify(sim7020_t *dev, kernel_pid_t pid) {
+  int res = 0;
+  unsigned state = irq_disable();
+
+  if (pid != KERNEL_PID_UNDEF && dev->recv_pid != KERNEL_PID_UNDEF && dev->recv_pid != pid)
+    res = -EBUSY;
   else
-    printf("recv_cb res %d\n", res);
+    dev->recv_pid = pid;
+  irq_restore(state);
+  return res;
+}
+
+int sim7020_recv(sim7020_t *dev, uint8_t *sockid, uint8_t *data, size_t datalen) {
+  uint16_t rd = atomic_load_explicit(&dev->recv_rd, memory_order_relaxed);
+  uint16_t wr = atomic_load_explicit(&dev->recv_wr, memory_order_acquire);
+
+  if (rd == wr)
+    return -EAGAIN;
+  uint16_t len = dev->recv_ring[rd & RECV_RING_MASK] | (dev->recv_ring[(rd + 1) & RECV_RING_MASK] << 8);
+  *sockid = dev->recv_ring[(rd + 2) & RECV_RING_MASK];
+  rd += RECV_HDR_LEN;
+  /* Truncate to caller's buffer */
+  for (uint16_t i = 0; i < len; i++, rd++) {
+    if (i < datalen)
+      data[i] = dev->recv_ring[rd & RECV_RING_MASK];
+  }
+  atomic_store_explicit(&dev->recv_rd, rd, memory_order_release);
+  return len < datalen ? len : datalen;
+}
+
+unsigned long sim7020_recv_dropped(sim7020_t *dev) {
+  return dev->recv_dropped;
 }
 
 void *sim7020_recv_thread(void *arg) {
-  unsigned int runsecs = (unsigned int) arg;
-  at_urc_t urc;
-
-  (void) runsecs;
-  urc.cb = _recv_cb;
-  urc.code = "+CSONMI:";
-  urc.arg = NULL;
-  at_add_urc(&at_dev, &urc);
+  sim7020_t *dev = arg;
+
+  dev->urc.cb = _recv_cb;
+  dev->urc.code = "+CSONMI:";
+  dev->urc.arg = dev;
+  at_add_urc(&dev->at_dev, &dev->urc);
   while (1) {
-    mutex_lock(&sim7020_lock);
-    at_process_urc(&at_dev, 1000*(uint32_t) 1000);
-    mutex_unlock(&sim7020_lock);
+    mutex_lock(&dev->lock);
+    at_process_urc(&dev->at_dev, 1000*(uint32_t) 1000);
+    mutex_unlock(&dev->lock);
   }
 }
 
-int sim7020_test(uint8_t sockid, int count) {
+#endif /* MODULE_SIM7020_RECV */
+
+#ifdef MODULE_SIM7020_DEBUG
+int sim7020_test(sim7020_t *dev, uint8_t sockid, int count) {
   static char testbuf[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVXYZ";
   
   while (count > 0) {
   for (unsigned int i = 1; i < sizeof(testbuf) && count > 0; i++) {
-      if (sim7020_send(sockid, (uint8_t *) testbuf, i) < 0)
+      if (sim7020_send(dev, sockid, (uint8_t *) testbuf, i) < 0)
         return -1;
       xtimer_sleep(3);
       if (count > 0)
@@ -317,3 +585,4 @@ int sim7020_test(uint8_t sockid, int count) {
   }
   return 0;
 }
+#endif /* MODULE_SIM7020_DEBUG */
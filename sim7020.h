@@ -1,17 +1,145 @@
 #ifndef SIM7020_H
 #define SIM7020_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "at.h"
+#include "mutex.h"
+#include "thread.h"
+
 #ifndef AT_RADIO_MAX_RECV_LEN
 #define AT_RADIO_MAX_RECV_LEN 1024
 #endif
-int sim7020_init(uint8_t uart, uint32_t baudrate);
-int sim7020_register(void);
-int sim7020_activate(void);
-int sim7020_status(void);
-int sim7020_udp_socket(void);
-int sim7020_close(uint8_t sockid);
-int sim7020_connect(uint8_t sockid, char *ipaddr, uint16_t port);
-int sim7020_send(uint8_t sockid, uint8_t *data, size_t datalen);
+#ifndef AT_RADIO_MAX_SEND_LEN
+#define AT_RADIO_MAX_SEND_LEN 128
+#endif
+
+/* Size of ring for received datagrams, must be a power of two */
+#ifndef SIM7020_RECV_RING_SIZE
+#define SIM7020_RECV_RING_SIZE 1024
+#endif
+
+/* Message type sent to the receiver when a datagram has arrived */
+#define SIM7020_MSG_RECV 0x7021
+
+/* Default network settings, used until changed at run time */
+#ifndef SIM7020_DEFAULT_OPERATOR
+#define SIM7020_DEFAULT_OPERATOR "24002"
+#endif
+#ifndef SIM7020_DEFAULT_APN
+#define SIM7020_DEFAULT_APN "internet"
+#endif
+
+/* Max no of bands in the band list */
+#ifndef SIM7020_MAX_BANDS
+#define SIM7020_MAX_BANDS 8
+#endif
+
+#define SIM7020_OPERATOR_LEN 8
+#define SIM7020_APN_LEN      32
+#define SIM7020_CRED_LEN     16
+
+/* Operator selection mode, values as in AT+COPS */
+typedef enum {
+  SIM7020_OPSEL_AUTO = 0,       /* Automatic selection */
+  SIM7020_OPSEL_MANUAL = 1,     /* Manual selection of operator */
+  SIM7020_OPSEL_MANUAL_AUTO = 4 /* Manual, fall back to automatic */
+} sim7020_opsel_t;
+
+typedef struct {
+  sim7020_opsel_t opsel;
+  char operator[SIM7020_OPERATOR_LEN];  /* MCCMNC */
+  char apn[SIM7020_APN_LEN];
+  char user[SIM7020_CRED_LEN];
+  char password[SIM7020_CRED_LEN];
+  uint8_t bands[SIM7020_MAX_BANDS];     /* Band list, for AT+CBAND */
+  uint8_t nbands;                       /* 0 means no band lock */
+} sim7020_conf_t;
+
+/* Initializer for a configuration with the default settings */
+#define SIM7020_CONF_DEFAULT {                  \
+    .opsel = SIM7020_OPSEL_MANUAL,              \
+    .operator = SIM7020_DEFAULT_OPERATOR,       \
+    .apn = SIM7020_DEFAULT_APN,                 \
+    .user = "",                                 \
+    .password = "",                             \
+    .nbands = 0,                                \
+  }
+
+/* Last successful attach, saved in flash */
+typedef struct {
+  uint16_t magic;                       /* SIM7020_CELL_MAGIC if valid */
+  uint8_t band;
+  uint8_t reserved;
+  uint32_t cellid;
+  char operator[SIM7020_OPERATOR_LEN];
+} sim7020_cell_t;
+
+#define SIM7020_CELL_MAGIC 0x7020
+
+#ifndef SIM7020_BUF_SIZE
+#define SIM7020_BUF_SIZE 256
+#endif
+#ifndef SIM7020_RESP_SIZE
+#define SIM7020_RESP_SIZE 1024
+#endif
+
+/* Device descriptor, one per modem */
+typedef struct sim7020 {
+  at_dev_t at_dev;
+  char buf[SIM7020_BUF_SIZE];           /* AT device input buffer */
+  char resp[SIM7020_RESP_SIZE];
+  mutex_t lock;
+  uint8_t num;                          /* Device no, 0 for the first */
+  uint8_t uart;
+  uint8_t sockets;                      /* Connected sockets, bit per sockid */
+  const sim7020_conf_t *conf;
+  sim7020_cell_t last_cell;
+#ifdef MODULE_SIM7020_RECV
+  at_urc_t urc;
+  uint8_t recv_ring[SIM7020_RECV_RING_SIZE];
+  atomic_uint_least16_t recv_wr;
+  atomic_uint_least16_t recv_rd;
+  volatile kernel_pid_t recv_pid;
+  unsigned long recv_dropped;
+#endif
+} sim7020_t;
+
+/*
+ * One-time setup of the device descriptor, before anything else. num
+ * is the device number, 0..N-1, which selects its flash page.
+ * sim7020_init can then be called again to reset the modem.
+ *
+ * The configuration is not copied -- the driver keeps a pointer to it,
+ * so it must stay valid while the driver is in use.
+ */
+void sim7020_setup(sim7020_t *dev, uint8_t num);
+int sim7020_init(sim7020_t *dev, uint8_t uart, uint32_t baudrate, const sim7020_conf_t *conf);
+int sim7020_register(sim7020_t *dev, const sim7020_conf_t *conf);
+int sim7020_activate(sim7020_t *dev);
+int sim7020_status(sim7020_t *dev);
+int sim7020_udp_socket(sim7020_t *dev);
+int sim7020_close(sim7020_t *dev, uint8_t sockid);
+int sim7020_connect(sim7020_t *dev, uint8_t sockid, char *ipaddr, uint16_t port);
+int sim7020_send(sim7020_t *dev, uint8_t sockid, uint8_t *data, size_t datalen);
+/* Registered with the network right now (asks the modem) */
+int sim7020_registered(sim7020_t *dev);
+/* Socket connected since the last modem reset */
+int sim7020_socket_connected(sim7020_t *dev, uint8_t sockid);
+/* Receive thread, arg is the device */
 void *sim7020_recv_thread(void *arg);
-int sim7020_test(uint8_t sockid, int count);
+/* Notify thread pid with SIM7020_MSG_RECV on received datagrams.
+ * The message content is the device. There is one consumer per
+ * device: returns -EBUSY if another thread is registered. Release
+ * with KERNEL_PID_UNDEF. */
+int sim7020_recv_notify(sim7020_t *dev, kernel_pid_t pid);
+/* Get next received datagram, without blocking. Returns -EAGAIN
+ * if there is none. Only one thread per device may call this. */
+int sim7020_recv(sim7020_t *dev, uint8_t *sockid, uint8_t *data, size_t datalen);
+unsigned long sim7020_recv_dropped(sim7020_t *dev);
+int sim7020_test(sim7020_t *dev, uint8_t sockid, int count);
+int sim7020_last_cell(sim7020_t *dev, sim7020_cell_t *cell);
+void sim7020_forget_cell(sim7020_t *dev);
 #endif /* SIM7020_H */
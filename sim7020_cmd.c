@@ -6,19 +6,94 @@
  * directory for more details.
  */
 
+#ifdef MODULE_SIM7020_SHELL
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "msg.h"
+#include "thread.h"
 
 #include "periph/uart.h"
 
 #include "sim7020.h"
+#include "sim7020_log.h"
+#ifdef MODULE_SIM7020_QUEUE
+#include "sim7020_queue.h"
+#endif
+#ifdef MODULE_SIM7020_DTLS
+#include "sim7020_dtls.h"
+#endif
+#ifdef MODULE_SIM7020_MP
+#include "sim7020_mp.h"
+#endif
+#ifdef MODULE_SIM7020_ENC
+#include "xtimer.h"
+#include "sim7020_enc.h"
+#endif
+
+/* UART of each modem */
+#ifndef SIM7020_UARTS
+#define SIM7020_UARTS { 1 }
+#endif
+#ifndef SIM7020_BAUDRATE
+#define SIM7020_BAUDRATE 9600
+#endif
+
+static const uint8_t sim7020_uarts[] = SIM7020_UARTS;
+#define SIM7020_NUMOF (sizeof(sim7020_uarts) / sizeof(sim7020_uarts[0]))
+
+static sim7020_t sim7020_devs[SIM7020_NUMOF];
+static sim7020_conf_t sim7020_confs[SIM7020_NUMOF];
+static uint8_t devs_ready;
+/* Device that the shell commands operate on */
+static unsigned int cur;
+
+/* Set up devices and default configurations, once */
+static void _setup(void) {
+  static const sim7020_conf_t conf_default = SIM7020_CONF_DEFAULT;
+
+  if (devs_ready)
+    return;
+  for (unsigned int i = 0; i < SIM7020_NUMOF; i++) {
+    sim7020_setup(&sim7020_devs[i], i);
+    sim7020_confs[i] = conf_default;
+  }
+  devs_ready = 1;
+}
+
+sim7020_t *sim7020cmd_dev(void) {
+  _setup();
+  return &sim7020_devs[cur];
+}
+
+static sim7020_conf_t *_conf(void) {
+  _setup();
+  return &sim7020_confs[cur];
+}
+
+int sim7020cmd_dev_select(int argc, char **argv) {
+  
+  if (argc == 2) {
+    unsigned int n = atoi(argv[1]);
+    if (n >= SIM7020_NUMOF) {
+      printf("No device %u (have %u)\n", n, (unsigned int) SIM7020_NUMOF);
+      return 1;
+    }
+    cur = n;
+  }
+  printf("Device %u on UART %d\n", cur, sim7020_uarts[cur]);
+  return 0;
+}
 
 int sim7020cmd_init(int argc, char **argv) {
   
   (void) argc; (void) argv;
 
-  int res = sim7020_init(UART_DEV(1), 9600);
+  int res = sim7020_init(sim7020cmd_dev(), sim7020_uarts[cur], SIM7020_BAUDRATE, _conf());
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -30,7 +105,7 @@ int sim7020cmd_register(int argc, char **argv) {
   
   (void) argc; (void) argv;
 
-  int res = sim7020_register();
+  int res = sim7020_register(sim7020cmd_dev(), _conf());
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -38,11 +113,87 @@ int sim7020cmd_register(int argc, char **argv) {
   return res;
 }
 
+static void _print_conf(void) {
+  sim7020_conf_t *conf = _conf();
+  sim7020_cell_t cell;
+
+  printf("Operator: %s (%s)\n", conf->operator,
+         conf->opsel == SIM7020_OPSEL_AUTO ? "auto" :
+         conf->opsel == SIM7020_OPSEL_MANUAL ? "manual" : "manual/auto");
+  printf("APN: \"%s\" user \"%s\"\n", conf->apn, conf->user);
+  printf("Bands:");
+  if (conf->nbands == 0)
+    printf(" all");
+  for (int i = 0; i < conf->nbands; i++)
+    printf(" %d", conf->bands[i]);
+  printf("\n");
+  if (sim7020_last_cell(sim7020cmd_dev(), &cell) == 0)
+    printf("Last cell: %lx band %d operator %s\n",
+           (unsigned long) cell.cellid, cell.band, cell.operator);
+  else
+    printf("Last cell: none\n");
+}
+
+static void _strlcpy(char *dst, const char *src, size_t size) {
+  strncpy(dst, src, size);
+  dst[size-1] = '\0';
+}
+
+int sim7020cmd_conf(int argc, char **argv) {
+  sim7020_conf_t *conf = _conf();
+
+  if (argc < 2) {
+    _print_conf();
+    return 0;
+  }
+  if (strcmp(argv[1], "op") == 0 && argc >= 3) {
+    if (strcmp(argv[2], "auto") == 0) {
+      conf->opsel = SIM7020_OPSEL_AUTO;
+    }
+    else {
+      _strlcpy(conf->operator, argv[2], sizeof(conf->operator));
+      if (argc == 4 && strcmp(argv[3], "fallback") == 0)
+        conf->opsel = SIM7020_OPSEL_MANUAL_AUTO;
+      else
+        conf->opsel = SIM7020_OPSEL_MANUAL;
+    }
+  }
+  else if (strcmp(argv[1], "apn") == 0 && argc >= 3) {
+    _strlcpy(conf->apn, argv[2], sizeof(conf->apn));
+    _strlcpy(conf->user, argc >= 4 ? argv[3] : "", sizeof(conf->user));
+    _strlcpy(conf->password, argc >= 5 ? argv[4] : "", sizeof(conf->password));
+  }
+  else if (strcmp(argv[1], "bands") == 0 && argc >= 3) {
+    conf->nbands = 0;
+    if (strcmp(argv[2], "all") != 0) {
+      char *ptr = argv[2];
+      while (*ptr && conf->nbands < SIM7020_MAX_BANDS) {
+        int band = strtol(ptr, &ptr, 10);
+        if (band > 0)
+          conf->bands[conf->nbands++] = band;
+        if (*ptr == ',')
+          ptr++;
+        else
+          break;
+      }
+    }
+  }
+  else if (strcmp(argv[1], "forget") == 0) {
+    sim7020_forget_cell(sim7020cmd_dev());
+  }
+  else {
+    printf("Usage: %s [op <mccmnc> [fallback]|op auto|apn <apn> [user [password]]|bands <b1,b2,..>|bands all|forget]\n", argv[0]);
+    return 1;
+  }
+  _print_conf();
+  return 0;
+}
+
 int sim7020cmd_activate(int argc, char **argv) {
   
   (void) argc; (void) argv;
 
-  int res = sim7020_activate();
+  int res = sim7020_activate(sim7020cmd_dev());
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -50,23 +201,25 @@ int sim7020cmd_activate(int argc, char **argv) {
   return res;
 }
   
+#ifdef MODULE_SIM7020_STATUS
 int sim7020cmd_status(int argc, char **argv) {
   
   (void) argc; (void) argv;
 
-  int res = sim7020_status();
+  int res = sim7020_status(sim7020cmd_dev());
   if (res < 0)
     printf("Error %d\n", res);
   else
     printf("OK");
   return res;
 }
+#endif /* MODULE_SIM7020_STATUS */
 
 int sim7020cmd_udp_socket(int argc, char **argv) {
   
   (void) argc; (void) argv;
 
-  int res = sim7020_udp_socket();
+  int res = sim7020_udp_socket(sim7020cmd_dev());
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -82,7 +235,7 @@ int sim7020cmd_close(int argc, char **argv) {
     return 1;
   }
   sockid = atoi(argv[1]);
-  int res = sim7020_close(sockid);
+  int res = sim7020_close(sim7020cmd_dev(), sockid);
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -102,7 +255,7 @@ int sim7020cmd_connect(int argc, char **argv) {
   sockid = atoi(argv[1]);
   ipaddr = argv[2];
   port = atoi(argv[3]);
-  int res = sim7020_connect(sockid, ipaddr, port);
+  int res = sim7020_connect(sim7020cmd_dev(), sockid, ipaddr, port);
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -120,7 +273,7 @@ int sim7020cmd_send(int argc, char **argv) {
   }
   sockid = atoi(argv[1]);
   data = argv[2];
-  int res = sim7020_send(sockid, (uint8_t *) data, strlen(data));
+  int res = sim7020_send(sim7020cmd_dev(), sockid, (uint8_t *) data, strlen(data));
   if (res < 0)
     printf("Error %d\n", res);
   else
@@ -128,28 +281,361 @@ int sim7020cmd_send(int argc, char **argv) {
   return res;
 }
 
-static char recvstack[THREAD_STACKSIZE_DEFAULT];
+#ifdef MODULE_SIM7020_QUEUE
+int sim7020cmd_qsend(int argc, char **argv) {
+  uint8_t chan;
+  char *data;
+  
+  if (argc < 3) {
+    printf("Usage: %s channel data\n", argv[0]);
+    return 1;
+  }
+  chan = atoi(argv[1]);
+  data = argv[2];
+  sim7020_queue_init();
+  int res = sim7020_queue_send(chan, (uint8_t *) data, strlen(data));
+  if (res < 0)
+    printf("Error %d\n", res);
+  else
+    printf("Queued");
+  return res;
+}
+
+int sim7020cmd_queue(int argc, char **argv) {
+  sim7020_queue_stats_t stats;
+
+  /* Channel goes to the selected device */
+  if (argc == 4 && strcmp(argv[1], "chan") == 0) {
+    int res = sim7020_queue_channel(atoi(argv[2]), sim7020cmd_dev(), atoi(argv[3]));
+    if (res < 0)
+      printf("Error %d\n", res);
+    return res;
+  }
+  if (argc != 1) {
+    printf("Usage: %s [chan channel sockid]\n", argv[0]);
+    return 1;
+  }
+  sim7020_queue_stats(&stats);
+  printf("Queue: %u datagrams (%u bytes in RAM, %u in flash)\n",
+         stats.depth, stats.bytes, stats.spilled);
+  printf("Sent %lu dropped %lu expired %lu retries %lu\n",
+         stats.sent, stats.dropped, stats.expired, stats.retries);
+  return 0;
+}
+
+#endif /* MODULE_SIM7020_QUEUE */
+
+#ifdef MODULE_SIM7020_RECV
+static char recvstack[SIM7020_NUMOF][THREAD_STACKSIZE_DEFAULT];
+static char printstack[THREAD_STACKSIZE_DEFAULT];
 
 #define SIM7020_PRIO         (THREAD_PRIORITY_MAIN + 1)
+#define SIM7020_PRINT_PRIO   (THREAD_PRIORITY_MAIN + 2)
+
+static kernel_pid_t recv_pids[SIM7020_NUMOF];
+static kernel_pid_t print_pid = KERNEL_PID_UNDEF;
+
+static void _start_recv_thread(void) {
+  if (recv_pids[cur] > 0)
+    return;
+  recv_pids[cur] = thread_create(recvstack[cur], sizeof(recvstack[cur]), SIM7020_PRIO, 0,
+                                 sim7020_recv_thread, sim7020cmd_dev(), "sim7020");
+  printf("Receive thread started\n");
+}
+
+/* Print received datagrams, outside of the modem receive threads.
+ * The message tells which device has data. */
+static void *_print_thread(void *arg) {
+  (void) arg;
+  msg_t msg_queue[4];
+  static uint8_t data[AT_RADIO_MAX_RECV_LEN];
+  uint8_t sockid;
+  int len;
+
+  msg_init_queue(msg_queue, 4);
+  while (1) {
+    msg_t m;
+    msg_receive(&m);
+    sim7020_t *dev = m.content.ptr;
+    while ((len = sim7020_recv(dev, &sockid, data, sizeof(data))) >= 0) {
+      printf("Got %d bytes on device %d sockid %d\n", len,
+             (int) (dev - sim7020_devs), sockid);
+      for (int i = 0; i < len; i++) {
+        if (isprint(data[i]))
+          putchar(data[i]);
+        else
+          printf("0x%02x", data[i]);
+        putchar(' ');
+      }
+      putchar('\n');
+    }
+  }
+  return NULL;
+}
 
 int sim7020cmd_recv(int argc, char **argv) {
-  unsigned int runsecs;
+  
+  (void) argc; (void) argv;
+
+  if (print_pid == KERNEL_PID_UNDEF)
+    print_pid = thread_create(printstack, sizeof(printstack), SIM7020_PRINT_PRIO, 0,
+                              _print_thread, NULL, "sim7020rx");
+  if (sim7020_recv_notify(sim7020cmd_dev(), print_pid) < 0) {
+    printf("Device has another receiver (DTLS?)\n");
+    return 1;
+  }
+  _start_recv_thread();
+  return 0;
+}
+#endif /* MODULE_SIM7020_RECV */
+
+#ifdef MODULE_SIM7020_DTLS
+static void _dtls_recv(const uint8_t *data, size_t len, void *arg) {
+  (void) arg;
+  printf("DTLS got %d bytes: %.*s\n", (int) len, (int) len, (const char *) data);
+}
+
+static int _hex2bin(const char *hex, uint8_t *bin, size_t size) {
+  size_t len = strlen(hex) / 2;
+
+  if (len > size)
+    return -1;
+  for (size_t i = 0; i < len; i++) {
+    char hexstr[3] = { hex[2*i], hex[2*i+1], '\0' };
+    bin[i] = (uint8_t) strtoul(hexstr, NULL, 16);
+  }
+  return len;
+}
+
+int sim7020cmd_dtls_connect(int argc, char **argv) {
+  uint8_t key[SIM7020_DTLS_PSK_KEY_LEN];
+  int keylen;
+  
+  if (argc < 4) {
+    printf("Usage: %s sockid identity hexkey\n", argv[0]);
+    return 1;
+  }
+  keylen = _hex2bin(argv[3], key, sizeof(key));
+  if (keylen <= 0) {
+    printf("Bad key\n");
+    return 1;
+  }
+  _start_recv_thread();
+  int res = sim7020_dtls_init(sim7020cmd_dev(), atoi(argv[1]), argv[2], key, keylen, _dtls_recv, NULL);
+  if (res == -EBUSY)
+    printf("Device has another receiver (urecv?)\n");
+  if (res == 0)
+    res = sim7020_dtls_connect(60*1000000);
+  if (res < 0)
+    printf("Error %d\n", res);
+  else
+    printf("OK");
+  return res;
+}
+
+int sim7020cmd_dtls_send(int argc, char **argv) {
   
   if (argc < 2) {
-    printf("Usage: %s runsecs\n", argv[0]);
+    printf("Usage: %s data\n", argv[0]);
     return 1;
   }
-  runsecs = atoi(argv[1]);
-  /* start the emcute thread */
-  //kernel_pid_t thread_create(char *stack, int stacksize, uint8_t priority, int flags, thread_task_func_t function, void *arg, const char *name)
+  int res = sim7020_dtls_send((uint8_t *) argv[1], strlen(argv[1]));
+  if (res < 0) {
+    printf("Error %d\n", res);
+    return res;
+  }
+  /* Wait a while for a response */
+  sim7020_dtls_process(2*1000000);
+  printf("OK");
+  return 0;
+}
 
-  thread_create(recvstack, sizeof(recvstack), SIM7020_PRIO, 0,
-                sim7020_recv_thread, (void *) runsecs, "sim7020");
-  printf("Receive thread started\n");
+int sim7020cmd_dtls_renew(int argc, char **argv) {
+  
+  (void) argc; (void) argv;
+
+  int res = sim7020_dtls_renew(60*1000000);
+  if (res < 0)
+    printf("Error %d\n", res);
+  else
+    printf("OK");
+  return res;
+}
+
+int sim7020cmd_dtls_close(int argc, char **argv) {
+  
+  (void) argc; (void) argv;
+
+  sim7020_dtls_close();
+  printf("OK");
+  return 0;
+}
+#endif /* MODULE_SIM7020_DTLS */
+
+#ifdef MODULE_SIM7020_ENC
+int sim7020cmd_enc_send(int argc, char **argv) {
+  uint8_t sockid;
+  char *data;
+  
+  if (argc < 3) {
+    printf("Usage: %s sockid data\n", argv[0]);
+    return 1;
+  }
+  sockid = atoi(argv[1]);
+  data = argv[2];
+  int res = sim7020_enc_send(sim7020cmd_dev(), sockid, (uint8_t *) data, strlen(data));
+  if (res < 0)
+    printf("Error %d\n", res);
+  else
+    printf("OK");
+  return res;
+}
+
+#define BENCH_RECORDS 8
+#define BENCH_FIELDS  3
+#define BENCH_ROUNDS  20
+
+/* Synthetic telemetry: temperature, humidity (centi-units), pressure (Pa) */
+static void _bench_record(int i, int32_t *vals) {
+  vals[0] = 2150 + (i % 3) - 1;
+  vals[1] = 4512 - i;
+  vals[2] = 101325 + 7 * (i % 5) - 14;
+}
+
+int sim7020cmd_enc_bench(int argc, char **argv) {
+  static uint8_t in[SIM7020_ENC_MAX_INPUT];
+  static uint8_t out[AT_RADIO_MAX_SEND_LEN];
+  sim7020_delta_t st;
+  int32_t vals[BENCH_FIELDS];
+  size_t inlen = 0;
+  int outlen = 0;
+  uint32_t start, usecs;
+
+  (void) argc; (void) argv;
+
+  /* Text records, LZ compressed */
+  for (int i = 0; i < BENCH_RECORDS; i++) {
+    _bench_record(i, vals);
+    inlen += snprintf((char *) in + inlen, sizeof(in) - inlen, "%ld,%ld,%ld\n",
+                      (long) vals[0], (long) vals[1], (long) vals[2]);
+  }
+  start = xtimer_now_usec();
+  for (int r = 0; r < BENCH_ROUNDS; r++)
+    outlen = sim7020_enc_frame(in, inlen, out, sizeof(out));
+  usecs = (xtimer_now_usec() - start) / BENCH_ROUNDS;
+  if (outlen < 0) {
+    printf("lz:    %u bytes do not fit in frame\n", (unsigned int) inlen);
+    return 1;
+  }
+  printf("lz:    %u -> %d bytes (%d%%), %lu us\n", (unsigned int) inlen, outlen,
+         (int) (100 * outlen / inlen), (unsigned long) usecs);
+
+  int res = 0;
+  start = xtimer_now_usec();
+  for (int r = 0; r < BENCH_ROUNDS; r++)
+    res = sim7020_enc_unframe(out, outlen, in, sizeof(in));
+  usecs = (xtimer_now_usec() - start) / BENCH_ROUNDS;
+  if (res < 0) {
+    printf("unlz:  frame does not decode\n");
+    return 1;
+  }
+  printf("unlz:  %lu us\n", (unsigned long) usecs);
+
+  /* Binary records, delta coded, then LZ */
+  start = xtimer_now_usec();
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    sim7020_delta_init(&st, BENCH_FIELDS);
+    inlen = 0;
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+      _bench_record(i, vals);
+      res = sim7020_delta_encode(&st, vals, in + inlen, sizeof(in) - inlen);
+      if (res < 0) {
+        printf("delta: records do not fit in %u bytes\n", (unsigned int) sizeof(in));
+        return 1;
+      }
+      inlen += res;
+    }
+  }
+  usecs = (xtimer_now_usec() - start) / BENCH_ROUNDS;
+  printf("delta: %u -> %u bytes (%d%%), %lu us\n",
+         (unsigned int) sizeof(vals) * BENCH_RECORDS, (unsigned int) inlen,
+         (int) (100 * inlen / (sizeof(vals) * BENCH_RECORDS)), (unsigned long) usecs);
+  outlen = sim7020_enc_frame(in, inlen, out, sizeof(out));
+  if (outlen < 0)
+    printf("delta+lz: %u bytes do not fit in frame\n", (unsigned int) inlen);
+  else
+    printf("delta+lz: %d bytes\n", outlen);
   return 0;
 }
+#endif /* MODULE_SIM7020_ENC */
 
+#ifdef MODULE_SIM7020_MP
+int sim7020cmd_mp(int argc, char **argv) {
+  int res = 0;
+  
+  if (argc >= 3 && strcmp(argv[1], "add") == 0) {
+    res = sim7020_mp_add(sim7020cmd_dev(), atoi(argv[2]));
+  }
+  else if (argc >= 3 && strcmp(argv[1], "policy") == 0) {
+    if (strcmp(argv[2], "failover") == 0)
+      sim7020_mp_set_policy(SIM7020_MP_FAILOVER);
+    else
+      sim7020_mp_set_policy(SIM7020_MP_ROUNDROBIN);
+  }
+  else if (argc >= 3 && strcmp(argv[1], "send") == 0) {
+    res = sim7020_mp_send((uint8_t *) argv[2], strlen(argv[2]));
+  }
+  else if (argc >= 4 && strcmp(argv[1], "bench") == 0) {
+    res = sim7020_mp_bench(atoi(argv[2]), atoi(argv[3]));
+  }
+  else if (argc == 2 && strcmp(argv[1], "stat") == 0) {
+    for (unsigned int i = 0; i < sim7020_mp_numof(); i++) {
+      const sim7020_mp_path_t *p = sim7020_mp_path(i);
+      printf("Path %u: device %d sockid %d %s sent %lu bytes %lu failed %lu\n", i,
+             (int) (p->dev - sim7020_devs), p->sockid, p->down_since ? "down" : "up",
+             p->sent, p->bytes, p->failed);
+    }
+  }
+  else {
+    printf("Usage: %s add sockid|policy rr|failover|send data|bench count len|stat\n", argv[0]);
+    return 1;
+  }
+  if (res < 0)
+    printf("Error %d\n", res);
+  else
+    printf("OK");
+  return res;
+}
+#endif /* MODULE_SIM7020_MP */
+
+int sim7020cmd_log(int argc, char **argv) {
+  
+  if (argc == 1) {
+    sim7020_log_show();
+    return 0;
+  }
+  if (argc != 3) {
+    printf("Usage: %s [drv|send|recv|queue|all level(0-4)]\n", argv[0]);
+    return 1;
+  }
+  if (sim7020_log_set(argv[1], atoi(argv[2])) < 0) {
+    printf("Unknown subsystem %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
+
+#ifdef MODULE_SIM7020_TRACE
+int sim7020cmd_trace(int argc, char **argv) {
+  
+  (void) argc; (void) argv;
+
+  sim7020_trace_dump();
+  return 0;
+}
+#endif /* MODULE_SIM7020_TRACE */
 
+#ifdef MODULE_SIM7020_DEBUG
 int sim7020cmd_test(int argc, char **argv) {
   uint8_t sockid;
   int count;
@@ -163,11 +649,13 @@ int sim7020cmd_test(int argc, char **argv) {
     count = atoi(argv[2]);
   else
     count = -1;
-  int res = sim7020_test(sockid, count);
+  int res = sim7020_test(sim7020cmd_dev(), sockid, count);
   if (res < 0)
     printf("Error %d\n", res);
   else
     printf("OK");
   return res;
 }
+#endif /* MODULE_SIM7020_DEBUG */
 
+#endif /* MODULE_SIM7020_SHELL */
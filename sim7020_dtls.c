@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MODULE_SIM7020_DTLS
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "msg.h"
+#include "thread.h"
+#include "xtimer.h"
+#include "dtls.h"
+
+#include "sim7020.h"
+#include "sim7020_dtls.h"
+#include "sim7020_log.h"
+
+static sim7020_t *dtls_dev;
+static dtls_context_t *dtls_ctx;
+static session_t session;       /* Single peer: the connected socket */
+static uint8_t dtls_sockid;
+static volatile int connected;
+
+static char psk_id[SIM7020_DTLS_PSK_ID_LEN];
+static uint8_t psk_key[SIM7020_DTLS_PSK_KEY_LEN];
+static size_t psk_keylen;
+
+static sim7020_dtls_recv_cb_t recv_cb;
+static void *recv_arg;
+
+static msg_t msg_queue[4];
+
+static int _write(dtls_context_t *ctx, session_t *s, uint8_t *buf, size_t len) {
+  (void) ctx; (void) s;
+
+  if (len > AT_RADIO_MAX_SEND_LEN) {
+    SIM7020_LOG(SEND, ERROR, "DTLS record too large: %u\n", (unsigned int) len);
+    return -EMSGSIZE;
+  }
+  return sim7020_send(dtls_dev, dtls_sockid, buf, len);
+}
+
+static int _read(dtls_context_t *ctx, session_t *s, uint8_t *buf, size_t len) {
+  (void) ctx; (void) s;
+
+  if (recv_cb != NULL)
+    recv_cb(buf, len, recv_arg);
+  return 0;
+}
+
+static int _event(dtls_context_t *ctx, session_t *s,
+                  dtls_alert_level_t level, unsigned short code) {
+  (void) ctx; (void) s;
+
+  if (code == DTLS_EVENT_CONNECTED) {
+    SIM7020_LOG(DRV, INFO, "DTLS connected\n");
+    connected = 1;
+  }
+  else if (level == DTLS_ALERT_LEVEL_FATAL || code == DTLS_ALERT_CLOSE_NOTIFY) {
+    SIM7020_LOG(DRV, WARNING, "DTLS alert %d, session lost\n", code);
+    connected = 0;
+  }
+  return 0;
+}
+
+static int _get_psk_info(dtls_context_t *ctx, const session_t *s,
+                         dtls_credentials_type_t type,
+                         const unsigned char *desc, size_t desc_len,
+                         unsigned char *result, size_t result_length) {
+  (void) ctx; (void) s; (void) desc; (void) desc_len;
+
+  switch (type) {
+  case DTLS_PSK_IDENTITY:
+    if (result_length < strlen(psk_id))
+      break;
+    memcpy(result, psk_id, strlen(psk_id));
+    return strlen(psk_id);
+  case DTLS_PSK_KEY:
+    if (result_length < psk_keylen)
+      break;
+    memcpy(result, psk_key, psk_keylen);
+    return psk_keylen;
+  default:
+    return 0;
+  }
+  return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+}
+
+static dtls_handler_t handlers = {
+  .write = _write,
+  .read = _read,
+  .event = _event,
+  .get_psk_info = _get_psk_info,
+};
+
+int sim7020_dtls_init(sim7020_t *dev, uint8_t sockid, const char *identity,
+                      const uint8_t *key, size_t keylen,
+                      sim7020_dtls_recv_cb_t cb, void *arg) {
+  if (strlen(identity) >= sizeof(psk_id) || keylen > sizeof(psk_key))
+    return -EINVAL;
+  /* We take all datagrams on the device, so nobody else may */
+  if (sim7020_recv_notify(dev, thread_getpid()) < 0)
+    return -EBUSY;
+  if (dtls_dev != NULL && dtls_dev != dev)
+    sim7020_recv_notify(dtls_dev, KERNEL_PID_UNDEF);
+  strcpy(psk_id, identity);
+  memcpy(psk_key, key, keylen);
+  psk_keylen = keylen;
+  recv_cb = cb;
+  recv_arg = arg;
+  dtls_dev = dev;
+  dtls_sockid = sockid;
+
+  /* A new socket means a new session */
+  if (dtls_ctx != NULL)
+    dtls_free_context(dtls_ctx);
+  else
+    dtls_init();
+  connected = 0;
+  dtls_ctx = dtls_new_context(NULL);
+  if (dtls_ctx == NULL)
+    return -ENOMEM;
+  dtls_set_handler(dtls_ctx, &handlers);
+  memset(&session, 0, sizeof(session));
+  session.size = sizeof(session.addr);
+  msg_init_queue(msg_queue, 4);
+  return 0;
+}
+
+int sim7020_dtls_connected(void) {
+  return connected;
+}
+
+/* Feed received datagrams to tinydtls, and retransmit handshake
+ * messages when due. Waits at most timeout usecs for data. */
+int sim7020_dtls_process(uint32_t timeout) {
+  static uint8_t data[AT_RADIO_MAX_RECV_LEN];
+  uint8_t sockid;
+  int len;
+  int count = 0;
+  msg_t m;
+
+  if (dtls_ctx == NULL)
+    return -ENOTCONN;
+  if (xtimer_msg_receive_timeout(&m, timeout) >= 0 || timeout == 0) {
+    while ((len = sim7020_recv(dtls_dev, &sockid, data, sizeof(data))) >= 0) {
+      if (sockid != dtls_sockid) {
+        SIM7020_LOG(RECV, WARNING, "DTLS: dropped %d bytes on sockid %d\n", len, sockid);
+        continue;
+      }
+      dtls_handle_message(dtls_ctx, &session, data, len);
+      count++;
+    }
+  }
+  dtls_check_retransmit(dtls_ctx, NULL);
+  return count;
+}
+
+int sim7020_dtls_connect(uint32_t timeout) {
+  uint32_t start = xtimer_now_usec();
+  dtls_peer_t *peer;
+
+  if (dtls_ctx == NULL)
+    return -ENOTCONN;
+  /* Session kept, e.g. after PSM -- no handshake */
+  if (connected)
+    return 0;
+  /* Start over with a fresh handshake */
+  peer = dtls_get_peer(dtls_ctx, &session);
+  if (peer != NULL)
+    dtls_reset_peer(dtls_ctx, peer);
+  if (dtls_connect(dtls_ctx, &session) < 0)
+    return -EIO;
+  while (!connected) {
+    if (xtimer_now_usec() - start > timeout)
+      return -ETIMEDOUT;
+    sim7020_dtls_process(1000000);
+  }
+  return 0;
+}
+
+int sim7020_dtls_renew(uint32_t timeout) {
+  if (dtls_ctx == NULL)
+    return -ENOTCONN;
+  SIM7020_LOG(DRV, INFO, "DTLS session dropped, new handshake\n");
+  connected = 0;
+  return sim7020_dtls_connect(timeout);
+}
+
+int sim7020_dtls_send(const uint8_t *data, size_t len) {
+  if (dtls_ctx == NULL)
+    return -ENOTCONN;
+  /* Session lost on a fatal alert */
+  if (!connected) {
+    int res = sim7020_dtls_connect(SIM7020_DTLS_HANDSHAKE_TIMEOUT);
+    if (res < 0)
+      return res;
+  }
+  if (len > SIM7020_DTLS_MAX_DATA)
+    len = SIM7020_DTLS_MAX_DATA;
+  return dtls_write(dtls_ctx, &session, (uint8_t *) data, len);
+}
+
+void sim7020_dtls_close(void) {
+  if (dtls_ctx == NULL)
+    return;
+  dtls_close(dtls_ctx, &session);
+  connected = 0;
+  dtls_free_context(dtls_ctx);
+  dtls_ctx = NULL;
+  sim7020_recv_notify(dtls_dev, KERNEL_PID_UNDEF);
+  dtls_dev = NULL;
+}
+
+#endif /* MODULE_SIM7020_DTLS */
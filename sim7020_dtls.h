@@ -0,0 +1,56 @@
+#ifndef SIM7020_DTLS_H
+#define SIM7020_DTLS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sim7020.h"
+
+/* Max application data per datagram: send window minus DTLS record
+ * header (13), explicit nonce (8) and CCM-8 tag (8) */
+#define SIM7020_DTLS_MAX_DATA (AT_RADIO_MAX_SEND_LEN - 29)
+
+#ifndef SIM7020_DTLS_PSK_ID_LEN
+#define SIM7020_DTLS_PSK_ID_LEN 32
+#endif
+#ifndef SIM7020_DTLS_PSK_KEY_LEN
+#define SIM7020_DTLS_PSK_KEY_LEN 16
+#endif
+
+/* Handshake timeout for sends that need a new handshake (usecs) */
+#ifndef SIM7020_DTLS_HANDSHAKE_TIMEOUT
+#define SIM7020_DTLS_HANDSHAKE_TIMEOUT (60*1000000)
+#endif
+
+typedef void (*sim7020_dtls_recv_cb_t)(const uint8_t *data, size_t len, void *arg);
+
+/*
+ * DTLS 1.2 (PSK) over a connected SIM7020 UDP socket, using tinydtls.
+ * Received datagrams are taken from the driver's receive ring, so
+ * the receive thread must be running, and the thread that calls these
+ * functions gets the receive notifications. That makes it the
+ * device's only receiver: sim7020_dtls_init fails with -EBUSY when
+ * another thread is registered, and datagrams for other sockets on
+ * the device are dropped (logged).
+ *
+ * The session is kept across PSM and idle periods; sim7020_dtls_connect
+ * and sim7020_dtls_send only do a full handshake when there is none,
+ * i.e. at start and after a fatal alert from the peer. There is no
+ * session resumption or connection ID (tinydtls supports neither), so
+ * the server finds the session by the client's address and port. If
+ * the application finds the peer has lost it (e.g. no reply after a
+ * NAT rebinding), sim7020_dtls_renew drops the session and does a new
+ * handshake. With a new socket, call sim7020_dtls_init again.
+ * Timeouts are in usecs.
+ */
+int sim7020_dtls_init(sim7020_t *dev, uint8_t sockid, const char *identity,
+                      const uint8_t *key, size_t keylen,
+                      sim7020_dtls_recv_cb_t cb, void *arg);
+int sim7020_dtls_connect(uint32_t timeout);
+int sim7020_dtls_renew(uint32_t timeout);
+int sim7020_dtls_send(const uint8_t *data, size_t len);
+int sim7020_dtls_process(uint32_t timeout);
+void sim7020_dtls_close(void);
+int sim7020_dtls_connected(void);
+
+#endif /* SIM7020_DTLS_H */
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MODULE_SIM7020_ENC
+
+#include <string.h>
+#include <errno.h>
+
+#include "sim7020_enc.h"
+
+/*
+ * Delta records: flags, sequence number, then one varint per field.
+ * Fields are absolute in key records, otherwise the difference from
+ * the previous record. Values are zigzag coded so small negative
+ * differences are short too.
+ */
+#define DELTA_KEY 0x01
+
+static int _put_varint(uint32_t v, uint8_t *out, size_t outlen) {
+  size_t n = 0;
+
+  do {
+    if (n == outlen)
+      return -1;
+    out[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+  return n;
+}
+
+static int _get_varint(const uint8_t *in, size_t inlen, uint32_t *v) {
+  size_t n = 0;
+  int shift = 0;
+
+  *v = 0;
+  do {
+    if (n == inlen || shift > 28)
+      return -1;
+    *v |= (uint32_t) (in[n] & 0x7f) << shift;
+    shift += 7;
+  } while (in[n++] & 0x80);
+  return n;
+}
+
+void sim7020_delta_init(sim7020_delta_t *st, uint8_t nfields) {
+  memset(st, 0, sizeof(*st));
+  st->nfields = nfields;
+}
+
+int sim7020_delta_encode(sim7020_delta_t *st, const int32_t *vals,
+                         uint8_t *out, size_t outlen) {
+  int key = (st->seq % SIM7020_DELTA_KEYFRAME) == 0;
+  size_t pos = 2;
+
+  if (outlen < pos)
+    return -1;
+  out[0] = key ? DELTA_KEY : 0;
+  out[1] = st->seq;
+  for (uint8_t i = 0; i < st->nfields; i++) {
+    int32_t d = key ? vals[i] : (int32_t) ((uint32_t) vals[i] - (uint32_t) st->prev[i]);
+    uint32_t zz = ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+    int n = _put_varint(zz, out + pos, outlen - pos);
+    if (n < 0)
+      return -1;
+    pos += n;
+  }
+  memcpy(st->prev, vals, st->nfields * sizeof(vals[0]));
+  st->seq++;
+  return pos;
+}
+
+int sim7020_delta_decode(sim7020_delta_t *st, const uint8_t *in, size_t inlen,
+                         int32_t *vals) {
+  size_t pos = 2;
+
+  if (inlen < pos)
+    return -1;
+  int key = in[0] & DELTA_KEY;
+  if (!key && (!st->synced || in[1] != (uint8_t) (st->seq + 1))) {
+    st->synced = 0;
+    return -1;
+  }
+  for (uint8_t i = 0; i < st->nfields; i++) {
+    uint32_t zz;
+    int n = _get_varint(in + pos, inlen - pos, &zz);
+    if (n < 0)
+      return -1;
+    pos += n;
+    int32_t d = (int32_t) (zz >> 1) ^ -(int32_t) (zz & 1);
+    vals[i] = key ? d : (int32_t) ((uint32_t) st->prev[i] + (uint32_t) d);
+  }
+  memcpy(st->prev, vals, st->nfields * sizeof(vals[0]));
+  st->seq = in[1];
+  st->synced = 1;
+  return pos;
+}
+
+/*
+ * LZSS, heatshrink style. Bit stream, MSB first. A 1 bit is followed
+ * by an 8-bit literal; a 0 bit by a back-reference: offset-1 in
+ * WINDOW_BITS, length-MIN_MATCH in LENGTH_BITS. Padding at the end is
+ * shorter than a literal, so it is never mistaken for a token.
+ */
+#define WINDOW_BITS 8
+#define LENGTH_BITS 4
+#define WINDOW_SIZE (1 << WINDOW_BITS)
+#define MIN_MATCH   2
+#define MAX_MATCH   ((1 << LENGTH_BITS) + MIN_MATCH - 1)
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t bit;
+} bitwriter_t;
+
+static int _put_bits(bitwriter_t *bw, uint16_t v, uint8_t nbits) {
+  while (nbits--) {
+    size_t byte = bw->bit >> 3;
+    uint8_t mask = 0x80 >> (bw->bit & 7);
+    if (byte == bw->size)
+      return -1;
+    if ((bw->bit & 7) == 0)
+      bw->buf[byte] = 0;
+    if (v & (1 << nbits))
+      bw->buf[byte] |= mask;
+    bw->bit++;
+  }
+  return 0;
+}
+
+static uint16_t _get_bits(const uint8_t *buf, size_t *bit, uint8_t nbits) {
+  uint16_t v = 0;
+
+  while (nbits--) {
+    v = (v << 1) | ((buf[*bit >> 3] >> (7 - (*bit & 7))) & 1);
+    (*bit)++;
+  }
+  return v;
+}
+
+int sim7020_lz_compress(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen) {
+  bitwriter_t bw = { out, outlen, 0 };
+  size_t i = 0;
+
+  while (i < inlen) {
+    size_t best_len = 0, best_off = 0;
+    size_t start = i > WINDOW_SIZE ? i - WINDOW_SIZE : 0;
+
+    for (size_t j = start; j < i; j++) {
+      size_t l = 0;
+      while (l < MAX_MATCH && i + l < inlen && in[j + l] == in[i + l])
+        l++;
+      if (l > best_len) {
+        best_len = l;
+        best_off = i - j;
+      }
+    }
+    if (best_len >= MIN_MATCH) {
+      if (_put_bits(&bw, 0, 1) < 0 ||
+          _put_bits(&bw, best_off - 1, WINDOW_BITS) < 0 ||
+          _put_bits(&bw, best_len - MIN_MATCH, LENGTH_BITS) < 0)
+        return -1;
+      i += best_len;
+    }
+    else {
+      if (_put_bits(&bw, 1, 1) < 0 || _put_bits(&bw, in[i], 8) < 0)
+        return -1;
+      i++;
+    }
+  }
+  return (bw.bit + 7) >> 3;
+}
+
+int sim7020_lz_decompress(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen) {
+  size_t bit = 0;
+  size_t nbits = inlen * 8;
+  size_t n = 0;
+
+  while (nbits - bit >= 9) {
+    if (_get_bits(in, &bit, 1)) {
+      if (n == outlen)
+        return -1;
+      out[n++] = _get_bits(in, &bit, 8);
+    }
+    else {
+      if (nbits - bit < WINDOW_BITS + LENGTH_BITS)
+        return -1;
+      size_t off = _get_bits(in, &bit, WINDOW_BITS) + 1;
+      size_t len = _get_bits(in, &bit, LENGTH_BITS) + MIN_MATCH;
+      if (off > n || n + len > outlen)
+        return -1;
+      while (len--) {
+        out[n] = out[n - off];
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+int sim7020_enc_frame(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen) {
+  int res;
+
+  if (outlen < 1)
+    return -1;
+  res = sim7020_lz_compress(in, inlen, out + 1, outlen - 1);
+  if (res >= 0 && (size_t) res < inlen) {
+    out[0] = SIM7020_ENC_LZ;
+    return res + 1;
+  }
+  /* Does not compress, send as is */
+  if (inlen + 1 > outlen)
+    return -1;
+  out[0] = SIM7020_ENC_RAW;
+  memcpy(out + 1, in, inlen);
+  return inlen + 1;
+}
+
+int sim7020_enc_unframe(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen) {
+  if (inlen < 1)
+    return -1;
+  switch (in[0]) {
+  case SIM7020_ENC_LZ:
+    return sim7020_lz_decompress(in + 1, inlen - 1, out, outlen);
+  case SIM7020_ENC_RAW:
+    if (inlen - 1 > outlen)
+      return -1;
+    memcpy(out, in + 1, inlen - 1);
+    return inlen - 1;
+  default:
+    return -1;
+  }
+}
+
+#ifndef SIM7020_ENC_HOST
+int sim7020_enc_send(sim7020_t *dev, uint8_t sockid, const uint8_t *data, size_t datalen) {
+  uint8_t frame[AT_RADIO_MAX_SEND_LEN];
+
+  if (datalen > SIM7020_ENC_MAX_INPUT)
+    return -EMSGSIZE;
+  int len = sim7020_enc_frame(data, datalen, frame, sizeof(frame));
+  if (len < 0)
+    return -EMSGSIZE;
+  return sim7020_send(dev, sockid, frame, len);
+}
+#endif /* SIM7020_ENC_HOST */
+
+#endif /* MODULE_SIM7020_ENC */
@@ -0,0 +1,65 @@
+#ifndef SIM7020_ENC_H
+#define SIM7020_ENC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Payload encoding for uplink telemetry: delta/varint coding of
+ * numeric records, and an LZSS compressor in the style of heatshrink
+ * (small window, bit-packed literals and back-references).
+ *
+ * Everything except sim7020_enc_send is plain C, so the decoders can
+ * be built on the server:
+ *   cc -DMODULE_SIM7020_ENC -DSIM7020_ENC_HOST -c sim7020_enc.c
+ */
+
+/* Max input to sim7020_enc_send -- accepted if it compresses into a frame */
+#ifndef SIM7020_ENC_MAX_INPUT
+#define SIM7020_ENC_MAX_INPUT 256
+#endif
+
+/* Max fields in a delta-coded record */
+#ifndef SIM7020_DELTA_MAX_FIELDS
+#define SIM7020_DELTA_MAX_FIELDS 8
+#endif
+
+/* Absolute (key) record every this many records, so the decoder can
+ * resynchronize after lost datagrams */
+#ifndef SIM7020_DELTA_KEYFRAME
+#define SIM7020_DELTA_KEYFRAME 16
+#endif
+
+/* Frame types (first byte of a frame) */
+#define SIM7020_ENC_RAW 0x00
+#define SIM7020_ENC_LZ  0x01
+
+typedef struct {
+  int32_t prev[SIM7020_DELTA_MAX_FIELDS];
+  uint8_t nfields;
+  uint8_t seq;
+  uint8_t synced;               /* Decoder: have seen key record */
+} sim7020_delta_t;
+
+void sim7020_delta_init(sim7020_delta_t *st, uint8_t nfields);
+/* Returns bytes written, or -1 if out is too small */
+int sim7020_delta_encode(sim7020_delta_t *st, const int32_t *vals,
+                         uint8_t *out, size_t outlen);
+/* Returns bytes consumed, or -1 on error (lost records: wait for key) */
+int sim7020_delta_decode(sim7020_delta_t *st, const uint8_t *in, size_t inlen,
+                         int32_t *vals);
+
+/* Return output length, or -1 if it does not fit */
+int sim7020_lz_compress(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen);
+int sim7020_lz_decompress(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen);
+
+/* Frame: type byte, then data compressed if that makes it smaller */
+int sim7020_enc_frame(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen);
+int sim7020_enc_unframe(const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen);
+
+#ifndef SIM7020_ENC_HOST
+#include "sim7020.h"
+int sim7020_enc_send(sim7020_t *dev, uint8_t sockid, const uint8_t *data, size_t datalen);
+#endif
+
+#endif /* SIM7020_ENC_H */
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "irq.h"
+#include "xtimer.h"
+
+#include "sim7020_log.h"
+
+uint8_t sim7020_log_level[SIM7020_LOGSYS_NUMOF] = {
+  SIM7020_LOG_LEVEL_DRV,
+  SIM7020_LOG_LEVEL_SEND,
+  SIM7020_LOG_LEVEL_RECV,
+  SIM7020_LOG_LEVEL_QUEUE,
+};
+
+static const char *sys_names[SIM7020_LOGSYS_NUMOF] = {
+  "drv", "send", "recv", "queue",
+};
+
+int sim7020_log_set(const char *sys, uint8_t level) {
+  int all = (strcmp(sys, "all") == 0);
+  int found = 0;
+
+  for (int i = 0; i < SIM7020_LOGSYS_NUMOF; i++) {
+    if (all || strcmp(sys, sys_names[i]) == 0) {
+      sim7020_log_level[i] = level;
+      found = 1;
+    }
+  }
+  return found ? 0 : -1;
+}
+
+void sim7020_log_show(void) {
+  for (int i = 0; i < SIM7020_LOGSYS_NUMOF; i++)
+    printf("%s: %d\n", sys_names[i], sim7020_log_level[i]);
+}
+
+#ifdef MODULE_SIM7020_TRACE
+typedef struct {
+  uint32_t time;                /* usec */
+  uint8_t sys;
+  uint8_t event;
+  int16_t arg;
+} trace_rec_t;
+
+static trace_rec_t trace_ring[SIM7020_TRACE_NUMOF];
+static uint16_t trace_next;
+static uint16_t trace_count;
+
+void sim7020_trace(uint8_t sys, uint8_t event, int16_t arg) {
+  uint32_t now = xtimer_now_usec();
+  unsigned state = irq_disable();
+  trace_rec_t *rec = &trace_ring[trace_next];
+
+  trace_next = (trace_next + 1) % SIM7020_TRACE_NUMOF;
+  if (trace_count < SIM7020_TRACE_NUMOF)
+    trace_count++;
+  rec->time = now;
+  rec->sys = sys;
+  rec->event = event;
+  rec->arg = arg;
+  irq_restore(state);
+}
+
+void sim7020_trace_dump(void) {
+  unsigned state = irq_disable();
+  uint16_t count = trace_count;
+  uint16_t first = (trace_next + SIM7020_TRACE_NUMOF - count) % SIM7020_TRACE_NUMOF;
+  irq_restore(state);
+
+  for (uint16_t i = 0; i < count; i++) {
+    trace_rec_t rec = trace_ring[(first + i) % SIM7020_TRACE_NUMOF];
+    printf("%10lu %-5s %2d %d\n", (unsigned long) rec.time,
+           rec.sys < SIM7020_LOGSYS_NUMOF ? sys_names[rec.sys] : "?",
+           rec.event, rec.arg);
+  }
+}
+#endif /* MODULE_SIM7020_TRACE */
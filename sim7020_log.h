@@ -0,0 +1,81 @@
+#ifndef SIM7020_LOG_H
+#define SIM7020_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Log levels */
+#define SIM7020_LOG_NONE     0
+#define SIM7020_LOG_ERROR    1
+#define SIM7020_LOG_WARNING  2
+#define SIM7020_LOG_INFO     3
+#define SIM7020_LOG_DEBUG    4
+
+/* Subsystems */
+#define SIM7020_LOGSYS_DRV   0  /* Init, registration, activation */
+#define SIM7020_LOGSYS_SEND  1
+#define SIM7020_LOGSYS_RECV  2
+#define SIM7020_LOGSYS_QUEUE 3
+#define SIM7020_LOGSYS_NUMOF 4
+
+/*
+ * Compile-time max level, for all subsystems or per subsystem.
+ * Messages above it are not compiled in.
+ */
+#ifndef SIM7020_LOG_LEVEL
+#define SIM7020_LOG_LEVEL SIM7020_LOG_WARNING
+#endif
+#ifndef SIM7020_LOG_LEVEL_DRV
+#define SIM7020_LOG_LEVEL_DRV SIM7020_LOG_LEVEL
+#endif
+#ifndef SIM7020_LOG_LEVEL_SEND
+#define SIM7020_LOG_LEVEL_SEND SIM7020_LOG_LEVEL
+#endif
+#ifndef SIM7020_LOG_LEVEL_RECV
+#define SIM7020_LOG_LEVEL_RECV SIM7020_LOG_LEVEL
+#endif
+#ifndef SIM7020_LOG_LEVEL_QUEUE
+#define SIM7020_LOG_LEVEL_QUEUE SIM7020_LOG_LEVEL
+#endif
+
+/* Run-time level per subsystem, starts at the compile-time level */
+extern uint8_t sim7020_log_level[SIM7020_LOGSYS_NUMOF];
+
+#define SIM7020_LOG(sys, level, ...)                                      \
+  do {                                                                    \
+    if (SIM7020_LOG_##level <= SIM7020_LOG_LEVEL_##sys &&                 \
+        SIM7020_LOG_##level <= sim7020_log_level[SIM7020_LOGSYS_##sys])   \
+      printf(__VA_ARGS__);                                                \
+  } while (0)
+
+int sim7020_log_set(const char *sys, uint8_t level);
+void sim7020_log_show(void);
+
+/*
+ * Binary trace: fixed-size records (time, subsystem, event, argument)
+ * in a RAM ring, for diagnostics that are cheap enough to keep on.
+ */
+#define SIM7020_TRACE_INIT      1
+#define SIM7020_TRACE_REG       2       /* arg: band */
+#define SIM7020_TRACE_ACT       3       /* arg: result */
+#define SIM7020_TRACE_SEND      4       /* arg: length */
+#define SIM7020_TRACE_SEND_FAIL 5       /* arg: error */
+#define SIM7020_TRACE_RECV      6       /* arg: length */
+#define SIM7020_TRACE_RECV_DROP 7       /* arg: length */
+#define SIM7020_TRACE_QUEUE     8       /* arg: depth */
+#define SIM7020_TRACE_QUEUE_DROP 9      /* arg: length */
+
+#ifndef SIM7020_TRACE_NUMOF
+#define SIM7020_TRACE_NUMOF 64
+#endif
+
+#ifdef MODULE_SIM7020_TRACE
+void sim7020_trace(uint8_t sys, uint8_t event, int16_t arg);
+void sim7020_trace_dump(void);
+#define SIM7020_TRACE(sys, event, arg) \
+  sim7020_trace(SIM7020_LOGSYS_##sys, SIM7020_TRACE_##event, (arg))
+#else
+#define SIM7020_TRACE(sys, event, arg) do { } while (0)
+#endif
+
+#endif /* SIM7020_LOG_H */
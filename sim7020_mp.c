@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MODULE_SIM7020_MP
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mutex.h"
+#include "thread.h"
+#include "xtimer.h"
+
+#include "sim7020.h"
+#include "sim7020_mp.h"
+#include "sim7020_log.h"
+
+static sim7020_mp_path_t paths[SIM7020_MP_MAX_PATHS];
+static unsigned int npaths;
+static unsigned int next_path;
+static sim7020_mp_policy_t mp_policy = SIM7020_MP_ROUNDROBIN;
+static mutex_t mp_lock = MUTEX_INIT;
+
+int sim7020_mp_add(sim7020_t *dev, uint8_t sockid) {
+  int res;
+
+  mutex_lock(&mp_lock);
+  if (npaths == SIM7020_MP_MAX_PATHS) {
+    res = -ENOSPC;
+  }
+  else {
+    memset(&paths[npaths], 0, sizeof(paths[npaths]));
+    paths[npaths].dev = dev;
+    paths[npaths].sockid = sockid;
+    res = npaths++;
+  }
+  mutex_unlock(&mp_lock);
+  return res;
+}
+
+void sim7020_mp_set_policy(sim7020_mp_policy_t policy) {
+  mp_policy = policy;
+}
+
+unsigned int sim7020_mp_numof(void) {
+  return npaths;
+}
+
+const sim7020_mp_path_t *sim7020_mp_path(unsigned int n) {
+  return n < npaths ? &paths[n] : NULL;
+}
+
+static int _path_up(sim7020_mp_path_t *p, uint32_t now) {
+  return p->down_since == 0 || now - p->down_since > SIM7020_MP_RETRY * 1000000UL;
+}
+
+/* Send on one path and account for the result */
+static int _path_send(sim7020_mp_path_t *p, const uint8_t *data, size_t datalen) {
+  int res = sim7020_send(p->dev, p->sockid, (uint8_t *) data, datalen);
+
+  mutex_lock(&mp_lock);
+  if (res >= 0) {
+    p->sent++;
+    p->bytes += res;
+    p->down_since = 0;
+  }
+  else {
+    p->failed++;
+    p->down_since = xtimer_now_usec() | 1;
+    SIM7020_LOG(SEND, WARNING, "Path %d down\n", (int) (p - paths));
+  }
+  mutex_unlock(&mp_lock);
+  return res;
+}
+
+int sim7020_mp_send(const uint8_t *data, size_t datalen) {
+  uint32_t now = xtimer_now_usec();
+  unsigned int start;
+
+  mutex_lock(&mp_lock);
+  start = (mp_policy == SIM7020_MP_ROUNDROBIN) ? next_path : 0;
+  mutex_unlock(&mp_lock);
+
+  for (unsigned int k = 0; k < npaths; k++) {
+    unsigned int i = (start + k) % npaths;
+    if (!_path_up(&paths[i], now))
+      continue;
+    int res = _path_send(&paths[i], data, datalen);
+    if (res >= 0) {
+      if (mp_policy == SIM7020_MP_ROUNDROBIN)
+        next_path = (i + 1) % npaths;
+      return res;
+    }
+  }
+  return -ENETDOWN;
+}
+
+/*
+ * Throughput benchmark: one sender thread per path, each taking the
+ * next datagram as soon as its modem is done with the previous one,
+ * so faster paths carry more.
+ */
+static char bench_stacks[SIM7020_MP_MAX_PATHS][THREAD_STACKSIZE_DEFAULT];
+static uint8_t bench_data[AT_RADIO_MAX_SEND_LEN];
+static size_t bench_len;
+static unsigned int bench_left;
+static unsigned int bench_running;
+/* Unlocked by the last sender thread to finish */
+static mutex_t bench_done = MUTEX_INIT_LOCKED;
+
+static void *_bench_thread(void *arg) {
+  sim7020_mp_path_t *p = arg;
+
+  while (1) {
+    mutex_lock(&mp_lock);
+    int more = bench_left > 0;
+    if (more)
+      bench_left--;
+    mutex_unlock(&mp_lock);
+    if (!more)
+      break;
+    if (_path_send(p, bench_data, bench_len) < 0) {
+      /* Give the datagram back, and let other paths take it */
+      mutex_lock(&mp_lock);
+      bench_left++;
+      mutex_unlock(&mp_lock);
+      break;
+    }
+  }
+  mutex_lock(&mp_lock);
+  int last = --bench_running == 0;
+  mutex_unlock(&mp_lock);
+  if (last)
+    mutex_unlock(&bench_done);
+  return NULL;
+}
+
+int sim7020_mp_bench(unsigned int count, size_t len) {
+  unsigned long sent0[SIM7020_MP_MAX_PATHS], bytes0[SIM7020_MP_MAX_PATHS];
+  unsigned long total = 0;
+
+  if (npaths == 0)
+    return -ENOTCONN;
+  bench_len = len < sizeof(bench_data) ? len : sizeof(bench_data);
+  for (size_t i = 0; i < bench_len; i++)
+    bench_data[i] = '0' + i % 10;
+  bench_left = count;
+  for (unsigned int i = 0; i < npaths; i++) {
+    sent0[i] = paths[i].sent;
+    bytes0[i] = paths[i].bytes;
+  }
+
+  uint32_t start = xtimer_now_usec();
+  /* Threads have lower priority, none runs before all are counted */
+  bench_running = npaths;
+  for (unsigned int i = 0; i < npaths; i++) {
+    if (thread_create(bench_stacks[i], sizeof(bench_stacks[i]), THREAD_PRIORITY_MAIN + 1, 0,
+                      _bench_thread, &paths[i], "sim7020mp") < 0) {
+      SIM7020_LOG(DRV, ERROR, "Bench thread for path %u failed\n", i);
+      mutex_lock(&mp_lock);
+      bench_running--;
+      mutex_unlock(&mp_lock);
+    }
+  }
+  if (bench_running > 0)
+    mutex_lock(&bench_done);
+  uint32_t usecs = xtimer_now_usec() - start;
+
+  for (unsigned int i = 0; i < npaths; i++) {
+    printf("Path %u: %lu datagrams, %lu bytes\n", i,
+           paths[i].sent - sent0[i], paths[i].bytes - bytes0[i]);
+    total += paths[i].bytes - bytes0[i];
+  }
+  printf("Total %lu bytes in %lu ms, %lu bytes/s\n", total,
+         (unsigned long) usecs / 1000,
+         usecs ? (unsigned long) (total * 1000000ULL / usecs) : 0);
+  return bench_left == 0 ? 0 : -ENETDOWN;
+}
+
+#endif /* MODULE_SIM7020_MP */
@@ -0,0 +1,47 @@
+#ifndef SIM7020_MP_H
+#define SIM7020_MP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sim7020.h"
+
+#ifndef SIM7020_MP_MAX_PATHS
+#define SIM7020_MP_MAX_PATHS 2
+#endif
+
+/* Seconds a path is left out after a failed send */
+#ifndef SIM7020_MP_RETRY
+#define SIM7020_MP_RETRY 30
+#endif
+
+typedef enum {
+  SIM7020_MP_ROUNDROBIN,        /* Spread datagrams over all paths */
+  SIM7020_MP_FAILOVER           /* First working path in order added */
+} sim7020_mp_policy_t;
+
+/* A path is a connected socket on one modem */
+typedef struct {
+  sim7020_t *dev;
+  uint8_t sockid;
+  uint32_t down_since;          /* usec, 0 if up */
+  unsigned long sent;
+  unsigned long bytes;
+  unsigned long failed;
+} sim7020_mp_path_t;
+
+/*
+ * Multipath sender. Datagrams go out on one of the paths according
+ * to the policy; a path where sending fails is skipped for a while,
+ * and the next path is tried.
+ */
+int sim7020_mp_add(sim7020_t *dev, uint8_t sockid);
+void sim7020_mp_set_policy(sim7020_mp_policy_t policy);
+int sim7020_mp_send(const uint8_t *data, size_t datalen);
+unsigned int sim7020_mp_numof(void);
+const sim7020_mp_path_t *sim7020_mp_path(unsigned int n);
+/* Send count datagrams of len bytes, all paths in parallel, and
+ * report combined throughput */
+int sim7020_mp_bench(unsigned int count, size_t len);
+
+#endif /* SIM7020_MP_H */
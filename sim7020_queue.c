@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifdef MODULE_SIM7020_QUEUE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mutex.h"
+#include "msg.h"
+#include "thread.h"
+#include "xtimer.h"
+
+#include "sim7020.h"
+#include "sim7020_queue.h"
+#include "sim7020_log.h"
+
+/*
+ * RAM ring of records, each a two-byte header (length, channel)
+ * followed by the data. Records wrap around the end of the ring.
+ */
+#define HDR_LEN 2
+
+static uint8_t ring[SIM7020_QUEUE_SIZE];
+static uint16_t head;           /* Oldest record */
+static uint16_t used;           /* Bytes in ring */
+static uint16_t nrecs;          /* Records in ring */
+
+static mutex_t queue_lock = MUTEX_INIT;
+static sim7020_queue_stats_t stats;
+
+/* Device and socket of each channel. Records hold the channel, not
+ * the socket, since socket ids do not survive a modem reset. */
+static struct {
+  sim7020_t *dev;               /* NULL if not set */
+  uint8_t sockid;
+} channels[SIM7020_QUEUE_CHANNELS];
+
+static kernel_pid_t queue_pid = KERNEL_PID_UNDEF;
+static char queue_stack[THREAD_STACKSIZE_DEFAULT];
+
+#define SIM7020_QUEUE_PRIO   (THREAD_PRIORITY_MAIN + 1)
+#define QUEUE_MSG_WAKEUP     0x7020  /* New record */
+#define QUEUE_MSG_CHANNEL    0x7022  /* Channel set, try again now */
+
+static void _ring_put(uint16_t pos, const uint8_t *src, size_t len) {
+  pos %= sizeof(ring);
+  size_t n = sizeof(ring) - pos;
+  if (n > len)
+    n = len;
+  memcpy(&ring[pos], src, n);
+  memcpy(&ring[0], src + n, len - n);
+}
+
+static void _ring_get(uint16_t pos, uint8_t *dst, size_t len) {
+  pos %= sizeof(ring);
+  size_t n = sizeof(ring) - pos;
+  if (n > len)
+    n = len;
+  memcpy(dst, &ring[pos], n);
+  memcpy(dst + n, &ring[0], len - n);
+}
+
+#ifdef MODULE_MTD
+/*
+ * Flash spill area. One record per flash page: status byte, length,
+ * channel, data. Status is 0xff when written and cleared to 0 when
+ * the record has been sent, so pages only go from erased to written
+ * to consumed, and the area is erased when everything is consumed.
+ */
+#define SPILL_PENDING  0xff
+#define SPILL_DONE     0x00
+#define SPILL_HDR_LEN  3
+
+static mtd_dev_t *spill_mtd;
+static uint32_t spill_addr;
+static uint32_t spill_pages;
+static uint32_t spill_rd;       /* First pending page */
+static uint32_t spill_wr;       /* First free page */
+
+static uint32_t _spill_page(uint32_t page) {
+  return spill_addr + page * spill_mtd->page_size;
+}
+
+int sim7020_queue_spill(mtd_dev_t *mtd, uint32_t addr, uint32_t size) {
+  uint8_t hdr[SPILL_HDR_LEN];
+
+  if (mtd->page_size < SPILL_HDR_LEN + AT_RADIO_MAX_SEND_LEN)
+    return -EINVAL;
+  mutex_lock(&queue_lock);
+  spill_mtd = mtd;
+  spill_addr = addr;
+  spill_pages = size / mtd->page_size;
+  spill_rd = spill_wr = 0;
+  stats.spilled = 0;
+  /* Recover records left from before reboot */
+  for (uint32_t page = 0; page < spill_pages; page++) {
+    if (mtd_read(mtd, hdr, _spill_page(page), sizeof(hdr)) < 0)
+      break;
+    if (hdr[1] == 0xff)
+      break;                    /* Erased -- end of records */
+    spill_wr = page + 1;
+    if (hdr[0] == SPILL_DONE)
+      spill_rd = page + 1;
+    else
+      stats.spilled++;
+  }
+  stats.depth = nrecs + stats.spilled;
+  mutex_unlock(&queue_lock);
+  SIM7020_LOG(QUEUE, INFO, "Queue spill: %u pages, %u pending\n",
+         (unsigned int) spill_pages, stats.spilled);
+  if (stats.spilled && queue_pid != KERNEL_PID_UNDEF) {
+    msg_t m = { .type = QUEUE_MSG_WAKEUP };
+    msg_try_send(&m, queue_pid);
+  }
+  return 0;
+}
+
+static int _spill_put(uint8_t chan, const uint8_t *data, size_t len) {
+  uint8_t rec[SPILL_HDR_LEN + AT_RADIO_MAX_SEND_LEN];
+
+  if (spill_wr == spill_pages) {
+    if (spill_rd != spill_wr)
+      return -ENOSPC;
+    if (mtd_erase(spill_mtd, spill_addr, spill_pages * spill_mtd->page_size) < 0)
+      return -EIO;
+    spill_rd = spill_wr = 0;
+  }
+  rec[0] = SPILL_PENDING;
+  rec[1] = len;
+  rec[2] = chan;
+  memcpy(&rec[SPILL_HDR_LEN], data, len);
+  if (mtd_write(spill_mtd, rec, _spill_page(spill_wr), SPILL_HDR_LEN + len) < 0)
+    return -EIO;
+  spill_wr++;
+  stats.spilled++;
+  return 0;
+}
+
+static int _spill_peek(uint8_t *chan, uint8_t *data) {
+  uint8_t hdr[SPILL_HDR_LEN];
+
+  if (mtd_read(spill_mtd, hdr, _spill_page(spill_rd), sizeof(hdr)) < 0)
+    return -EIO;
+  if (hdr[1] > AT_RADIO_MAX_SEND_LEN)
+    return -EINVAL;
+  if (mtd_read(spill_mtd, data, _spill_page(spill_rd) + SPILL_HDR_LEN, hdr[1]) < 0)
+    return -EIO;
+  *chan = hdr[2];
+  return hdr[1];
+}
+
+static void _spill_pop(void) {
+  uint8_t done = SPILL_DONE;
+
+  mtd_write(spill_mtd, &done, _spill_page(spill_rd), 1);
+  spill_rd++;
+  stats.spilled--;
+}
+#endif /* MODULE_MTD */
+
+static int _spill_pending(void) {
+#ifdef MODULE_MTD
+  return spill_mtd != NULL && spill_rd != spill_wr;
+#else
+  return 0;
+#endif
+}
+
+int sim7020_queue_channel(uint8_t chan, sim7020_t *dev, uint8_t sockid) {
+  if (chan >= SIM7020_QUEUE_CHANNELS)
+    return -EINVAL;
+  mutex_lock(&queue_lock);
+  channels[chan].dev = dev;
+  channels[chan].sockid = sockid;
+  mutex_unlock(&queue_lock);
+  if (queue_pid != KERNEL_PID_UNDEF) {
+    msg_t m = { .type = QUEUE_MSG_CHANNEL };
+    msg_try_send(&m, queue_pid);
+  }
+  return 0;
+}
+
+int sim7020_queue_send(uint8_t chan, const uint8_t *data, size_t datalen) {
+  size_t len = (datalen < AT_RADIO_MAX_SEND_LEN ? datalen : AT_RADIO_MAX_SEND_LEN);
+  int res = 0;
+
+  if (chan >= SIM7020_QUEUE_CHANNELS)
+    return -EINVAL;
+  mutex_lock(&queue_lock);
+  /* Once records are in flash, new ones go there too to keep order */
+  if (!_spill_pending() && used + HDR_LEN + len <= sizeof(ring)) {
+    uint8_t hdr[HDR_LEN] = { len, chan };
+    _ring_put(head + used, hdr, HDR_LEN);
+    _ring_put(head + used + HDR_LEN, data, len);
+    used += HDR_LEN + len;
+    nrecs++;
+  }
+  else {
+#ifdef MODULE_MTD
+    if (spill_mtd != NULL)
+      res = _spill_put(chan, data, len);
+    else
+#endif
+      res = -ENOSPC;
+  }
+  if (res < 0) {
+    stats.dropped++;
+    SIM7020_TRACE(QUEUE, QUEUE_DROP, len);
+  }
+  stats.depth = nrecs + stats.spilled;
+  stats.bytes = used;
+  mutex_unlock(&queue_lock);
+
+  if (res == 0 && queue_pid != KERNEL_PID_UNDEF) {
+    msg_t m = { .type = QUEUE_MSG_WAKEUP };
+    msg_try_send(&m, queue_pid);
+  }
+  return res == 0 ? (int) len : res;
+}
+
+/* Copy oldest record, RAM first since it holds the older ones */
+static int _peek(uint8_t *chan, uint8_t *data) {
+  if (nrecs > 0) {
+    uint8_t hdr[HDR_LEN];
+    _ring_get(head, hdr, HDR_LEN);
+    _ring_get(head + HDR_LEN, data, hdr[0]);
+    *chan = hdr[1];
+    return hdr[0];
+  }
+#ifdef MODULE_MTD
+  if (_spill_pending())
+    return _spill_peek(chan, data);
+#endif
+  return -ENOENT;
+}
+
+static void _pop(void) {
+  if (nrecs > 0) {
+    uint8_t len;
+    _ring_get(head, &len, 1);
+    head = (head + HDR_LEN + len) % sizeof(ring);
+    used -= HDR_LEN + len;
+    nrecs--;
+  }
+#ifdef MODULE_MTD
+  else if (_spill_pending())
+    _spill_pop();
+#endif
+  stats.depth = nrecs + stats.spilled;
+  stats.bytes = used;
+}
+
+/* Wait secs seconds, or until a channel is set. New records do not
+ * cut the wait short. Returns 1 if a channel was set. */
+static int _backoff(uint32_t secs) {
+  uint64_t end = xtimer_now_usec64() + (uint64_t) secs * 1000000;
+  uint64_t now;
+  msg_t m;
+
+  while ((now = xtimer_now_usec64()) < end) {
+    if (xtimer_msg_receive_timeout(&m, end - now) < 0)
+      break;
+    if (m.type == QUEUE_MSG_CHANNEL)
+      return 1;
+  }
+  return 0;
+}
+
+static void *_queue_thread(void *arg) {
+  (void) arg;
+  msg_t msg_queue[4];
+  static uint8_t data[AT_RADIO_MAX_SEND_LEN];
+  uint8_t chan, sockid = 0;
+  sim7020_t *dev;
+  uint32_t retry = SIM7020_QUEUE_RETRY_MIN;
+  unsigned int attempts = 0;    /* Failed attempts for oldest record */
+
+  msg_init_queue(msg_queue, 4);
+  while (1) {
+    mutex_lock(&queue_lock);
+    int len = _peek(&chan, data);
+    if (len >= 0 && chan < SIM7020_QUEUE_CHANNELS) {
+      dev = channels[chan].dev;
+      sockid = channels[chan].sockid;
+    }
+    else
+      dev = NULL;
+    mutex_unlock(&queue_lock);
+
+    if (len < 0) {
+      if (len != -ENOENT) {
+        /* Unreadable flash record, skip it */
+        mutex_lock(&queue_lock);
+        _pop();
+        stats.dropped++;
+        mutex_unlock(&queue_lock);
+        continue;
+      }
+      msg_t m;
+      msg_receive(&m);
+      continue;
+    }
+    if (dev != NULL && sim7020_send(dev, sockid, data, len) >= 0) {
+      /* Sent -- go on with next without delay */
+      mutex_lock(&queue_lock);
+      _pop();
+      stats.sent++;
+      mutex_unlock(&queue_lock);
+      retry = SIM7020_QUEUE_RETRY_MIN;
+      attempts = 0;
+    }
+    else {
+      /*
+       * Only a failure with the link up counts against the record.
+       * Without a socket (e.g. recovered from flash before the
+       * application has set the channel) or out of coverage, the
+       * record waits however long it takes.
+       */
+      const char *why = NULL;
+
+      if (dev == NULL || !sim7020_socket_connected(dev, sockid))
+        why = "no socket";
+      else if (!sim7020_registered(dev))
+        why = "not registered";
+      if (why == NULL && ++attempts >= SIM7020_QUEUE_MAX_ATTEMPTS) {
+        /* Give up on this record, so it does not hold up the rest */
+        SIM7020_LOG(QUEUE, WARNING, "Dropped record on channel %d after %u attempts\n",
+                    chan, attempts);
+        mutex_lock(&queue_lock);
+        _pop();
+        stats.expired++;
+        mutex_unlock(&queue_lock);
+        SIM7020_TRACE(QUEUE, QUEUE_DROP, len);
+        attempts = 0;
+        continue;
+      }
+      if (dev != NULL) {
+        mutex_lock(&queue_lock);
+        stats.retries++;
+        mutex_unlock(&queue_lock);
+      }
+      SIM7020_LOG(QUEUE, INFO, "Send on channel %d failed (%s), retry in %lu s\n",
+                  chan, why ? why : "error", (unsigned long) retry);
+      SIM7020_TRACE(QUEUE, QUEUE, stats.depth);
+      if (_backoff(retry)) {
+        retry = SIM7020_QUEUE_RETRY_MIN;
+        continue;
+      }
+      retry *= 2;
+      if (retry > SIM7020_QUEUE_RETRY_MAX)
+        retry = SIM7020_QUEUE_RETRY_MAX;
+    }
+  }
+  return NULL;
+}
+
+int sim7020_queue_init(void) {
+  if (queue_pid != KERNEL_PID_UNDEF)
+    return 0;
+  queue_pid = thread_create(queue_stack, sizeof(queue_stack), SIM7020_QUEUE_PRIO, 0,
+                            _queue_thread, NULL, "sim7020q");
+  return queue_pid < 0 ? queue_pid : 0;
+}
+
+void sim7020_queue_stats(sim7020_queue_stats_t *st) {
+  mutex_lock(&queue_lock);
+  *st = stats;
+  mutex_unlock(&queue_lock);
+}
+
+#endif /* MODULE_SIM7020_QUEUE */
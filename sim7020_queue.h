@@ -0,0 +1,68 @@
+#ifndef SIM7020_QUEUE_H
+#define SIM7020_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sim7020.h"
+
+#ifdef MODULE_MTD
+#include "mtd.h"
+#endif
+
+/* Size of RAM ring for queued datagrams, in bytes */
+#ifndef SIM7020_QUEUE_SIZE
+#define SIM7020_QUEUE_SIZE 512
+#endif
+
+/* Retry interval after failed send, doubled up to max (seconds) */
+#ifndef SIM7020_QUEUE_RETRY_MIN
+#define SIM7020_QUEUE_RETRY_MIN 2
+#endif
+#ifndef SIM7020_QUEUE_RETRY_MAX
+#define SIM7020_QUEUE_RETRY_MAX 120
+#endif
+
+/* Failed sends with the link up before a datagram is dropped */
+#ifndef SIM7020_QUEUE_MAX_ATTEMPTS
+#define SIM7020_QUEUE_MAX_ATTEMPTS 8
+#endif
+
+/* No of channels (destinations) */
+#ifndef SIM7020_QUEUE_CHANNELS
+#define SIM7020_QUEUE_CHANNELS 4
+#endif
+
+typedef struct {
+  unsigned int depth;           /* Queued datagrams, RAM and flash */
+  unsigned int bytes;           /* Bytes used in RAM ring */
+  unsigned int spilled;         /* Queued datagrams in flash */
+  unsigned long sent;
+  unsigned long dropped;        /* No room in queue */
+  unsigned long expired;        /* Dropped after max attempts, link up */
+  unsigned long retries;        /* Failed send attempts */
+} sim7020_queue_stats_t;
+
+/*
+ * Store-and-forward queue in front of sim7020_send. Datagrams are
+ * kept until the modem accepts them, and sent by a separate thread,
+ * back to back while sending succeeds. A datagram is kept through
+ * any outage, and while its channel has no connected socket; it is
+ * only dropped when SIM7020_QUEUE_MAX_ATTEMPTS sends fail with the
+ * modem registered and the socket connected.
+ *
+ * Datagrams are queued on a channel, which is mapped to a device and
+ * socket with sim7020_queue_channel. Set it again when the socket is
+ * replaced (after a reboot or modem reset), and queued datagrams go
+ * to the new socket.
+ */
+int sim7020_queue_init(void);
+int sim7020_queue_channel(uint8_t chan, sim7020_t *dev, uint8_t sockid);
+int sim7020_queue_send(uint8_t chan, const uint8_t *data, size_t datalen);
+void sim7020_queue_stats(sim7020_queue_stats_t *stats);
+#ifdef MODULE_MTD
+/* Spill to flash when the RAM ring is full. addr and size must be
+ * sector aligned. Datagrams left in flash are recovered. */
+int sim7020_queue_spill(mtd_dev_t *mtd, uint32_t addr, uint32_t size);
+#endif
+#endif /* SIM7020_QUEUE_H */
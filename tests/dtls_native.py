@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2020 Peter Sjödin, KTH
+#
+# This file is subject to the terms and conditions of the GNU Lesser
+# General Public License v2.1. See the file LICENSE in the top level
+# directory for more details.
+#
+# DTLS test on native: the application talks to an emulated SIM7020 on
+# a pty, which relays the UDP socket to a local openssl DTLS server.
+# Checks the handshake, that the session is kept between sends (no new
+# handshake), and that 'drenew' does a new handshake with a server that
+# has lost the session.
+#
+# Run with 'make test-dtls', which builds the application for native
+# with the settings this test expects.
+#
+# Usage: dtls_native.py <native elf>
+
+import os
+import select
+import signal
+import socket
+import subprocess
+import sys
+import time
+import tty
+
+import pexpect
+
+PSK_ID = "Client_identity"
+PSK_KEY = "000102030405060708090a0b0c0d0e0f"
+PORT = 25684
+
+
+class Sim7020Emu:
+    """Enough of the SIM7020 AT interface for one UDP socket"""
+
+    def __init__(self):
+        self.master, self.slave = os.openpty()
+        tty.setraw(self.slave)
+        self.path = os.ttyname(self.slave)
+        self.sock = None
+        self.dest = None
+        self.line = b""
+        self.sending = 0        # Data bytes expected after send prompt
+        self.data = b""
+
+    def _write(self, s):
+        os.write(self.master, s.encode() if isinstance(s, str) else s)
+
+    def _resp(self, *lines):
+        for line in lines:
+            self._write("\r\n" + line + "\r\n")
+
+    def _command(self, cmd):
+        self._write(cmd + "\r")             # Echo
+        if cmd.startswith("AT+CSOC="):
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            self._resp("+CSOC: 0", "OK")
+        elif cmd.startswith("AT+CSOCON="):
+            _, port, addr = cmd.split("=")[1].split(",")
+            self.dest = (addr, int(port))
+            self._resp("OK")
+        elif cmd.startswith("AT+CSODSEND="):
+            self.sending = int(cmd.split(",")[1])
+            self.data = b""
+            self._write("\r\n> ")
+        elif cmd.startswith("AT+CSOCL"):
+            self.sock.close()
+            self.sock = None
+            self._resp("OK")
+        elif cmd == "AT+CSQ":
+            self._resp("+CSQ: 20,0", "OK")
+        else:
+            self._resp("OK")
+
+    def _uart_input(self, data):
+        for b in data:
+            if self.sending:
+                self.data += bytes([b])
+                self.sending -= 1
+                if not self.sending:
+                    self.sock.sendto(self.data, self.dest)
+                    self._resp("DATA ACCEPT:%d" % len(self.data))
+            elif b == ord("\r"):
+                if self.line:
+                    self._command(self.line.decode())
+                self.line = b""
+            elif b != ord("\n"):
+                self.line += bytes([b])
+
+    def poll(self, timeout):
+        fds = [self.master]
+        # No datagrams while the modem waits for send data
+        if self.sock is not None and not self.sending:
+            fds.append(self.sock)
+        ready, _, _ = select.select(fds, [], [], timeout)
+        if self.master in ready:
+            self._uart_input(os.read(self.master, 256))
+        if self.sock in ready:
+            data = self.sock.recv(2048)
+            self._resp("+CSONMI: 0,%d,%s" % (2 * len(data), data.hex().upper()))
+
+
+def start_server(out):
+    # Stdin must stay open, or s_server shuts down
+    return subprocess.Popen(
+        ["openssl", "s_server", "-dtls1_2", "-accept", str(PORT), "-nocert",
+         "-psk", PSK_KEY, "-psk_identity", PSK_ID,
+         "-cipher", "PSK-AES128-CCM8:@SECLEVEL=0"],
+        stdin=subprocess.PIPE, stdout=out, stderr=subprocess.STDOUT)
+
+
+def wait_output(path, text, emu, timeout):
+    end = time.time() + timeout
+    while time.time() < end:
+        emu.poll(0.1)
+        with open(path) as f:
+            if text in f.read():
+                return True
+    return False
+
+
+def handshakes(path):
+    with open(path) as f:
+        return f.read().count("CIPHER is")
+
+
+def command(app, emu, cmd, expect, timeout=10):
+    app.sendline(cmd)
+    end = time.time() + timeout
+    while time.time() < end:
+        emu.poll(0.05)
+        try:
+            app.expect(expect, timeout=0.05)
+            return
+        except pexpect.TIMEOUT:
+            pass
+    raise RuntimeError("'%s': no '%s'" % (cmd, expect))
+
+
+def main():
+    emu = Sim7020Emu()
+    server = start_server(open("/tmp/dtls_server1.out", "w"))
+    app = pexpect.spawn(sys.argv[1], ["-c", emu.path], encoding="utf-8",
+                        logfile=sys.stdout)
+    try:
+        time.sleep(1)
+        command(app, emu, "init", "OK")
+        command(app, emu, "usock", "Socket")
+        command(app, emu, "ucon 0 127.0.0.1 %d" % PORT, "OK")
+        command(app, emu, "dcon 0 %s %s" % (PSK_ID, PSK_KEY), "OK", 60)
+        command(app, emu, "dsend hello1", "OK", 30)
+        if not wait_output("/tmp/dtls_server1.out", "hello1", emu, 10):
+            raise RuntimeError("server did not get hello1")
+
+        # Quiet for a while, as in PSM: same session
+        time.sleep(10)
+        command(app, emu, "dsend hello2", "OK", 30)
+        if not wait_output("/tmp/dtls_server1.out", "hello2", emu, 10):
+            raise RuntimeError("server did not get hello2")
+        if handshakes("/tmp/dtls_server1.out") != 1:
+            raise RuntimeError("session not kept, new handshake for hello2")
+
+        # Server loses the session, as after a new NAT binding
+        server.send_signal(signal.SIGTERM)
+        server.wait()
+        server = start_server(open("/tmp/dtls_server2.out", "w"))
+        time.sleep(1)
+        command(app, emu, "drenew", "OK", 70)
+        command(app, emu, "dsend hello3", "OK", 30)
+        if not wait_output("/tmp/dtls_server2.out", "hello3", emu, 10):
+            raise RuntimeError("no new handshake, server did not get hello3")
+    except (RuntimeError, pexpect.EOF) as e:
+        print("\nFAILED: %s" % e)
+        return 1
+    finally:
+        app.terminate(force=True)
+        server.send_signal(signal.SIGTERM)
+    print("\nSUCCESS")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
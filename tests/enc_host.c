@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2020 Peter Sjödin, KTH
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Host test for the payload encoding: what the node encodes, the
+ * server-side decoders (the same sim7020_enc.c built with
+ * SIM7020_ENC_HOST) must give back. Run with 'make test-enc', or:
+ *   cc -DMODULE_SIM7020_ENC -DSIM7020_ENC_HOST -I. sim7020_enc.c tests/enc_host.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sim7020_enc.h"
+
+#define FRAME_MAX 512
+
+static int failed;
+
+#define CHECK(cond, ...) do {                   \
+    if (!(cond)) {                              \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);                      \
+      printf("\n");                             \
+      failed++;                                 \
+      return;                                   \
+    }                                           \
+  } while (0)
+
+/* Frames: random binary (stays raw) and small-alphabet text (LZ) */
+static void test_frame(void) {
+  static uint8_t in[SIM7020_ENC_MAX_INPUT], frame[FRAME_MAX], out[FRAME_MAX];
+
+  for (int t = 0; t < 20000; t++) {
+    size_t len = rand() % (sizeof(in) + 1);
+    for (size_t i = 0; i < len; i++)
+      in[i] = (t & 1) ? 'a' + rand() % 4 : rand();
+    int flen = sim7020_enc_frame(in, len, frame, sizeof(frame));
+    CHECK(flen > 0, "frame %d: %u bytes not framed", t, (unsigned int) len);
+    if (t & 1 && len > 32)
+      CHECK(frame[0] == SIM7020_ENC_LZ, "frame %d: text not compressed", t);
+    int olen = sim7020_enc_unframe(frame, flen, out, sizeof(out));
+    CHECK(olen == (int) len && memcmp(in, out, len) == 0,
+          "frame %d: %u bytes in, %d out", t, (unsigned int) len, olen);
+  }
+}
+
+/* Truncated or garbage frames are rejected, not decoded past the end */
+static void test_frame_errors(void) {
+  static uint8_t in[SIM7020_ENC_MAX_INPUT], frame[FRAME_MAX], out[FRAME_MAX];
+
+  for (size_t i = 0; i < sizeof(in); i++)
+    in[i] = 'a' + i % 7;
+  int flen = sim7020_enc_frame(in, sizeof(in), frame, sizeof(frame));
+  CHECK(flen > 0 && frame[0] == SIM7020_ENC_LZ, "text not compressed");
+  CHECK(sim7020_enc_unframe(frame, flen, out, sizeof(in) - 1) < 0,
+        "output overrun not detected");
+  CHECK(sim7020_enc_unframe(frame, 0, out, sizeof(out)) < 0, "empty frame decoded");
+  frame[0] = 0x7f;
+  CHECK(sim7020_enc_unframe(frame, flen, out, sizeof(out)) < 0, "bad type decoded");
+  for (int t = 0; t < 1000; t++) {
+    frame[0] = SIM7020_ENC_LZ;
+    for (int i = 1; i < 64; i++)
+      frame[i] = rand();
+    /* Any result is fine, as long as it stays within out */
+    int olen = sim7020_enc_unframe(frame, 64, out, sizeof(out));
+    CHECK(olen <= (int) sizeof(out), "garbage %d: %d bytes out", t, olen);
+  }
+}
+
+/* Delta records, including int32 extremes and lost datagrams */
+static void test_delta(void) {
+  sim7020_delta_t enc, dec;
+  int32_t vals[SIM7020_DELTA_MAX_FIELDS], got[SIM7020_DELTA_MAX_FIELDS];
+  uint8_t rec[64];
+  int lost = 0;
+  const int32_t extremes[] = { INT32_MIN, INT32_MAX, 0, -1, INT32_MIN, 1, INT32_MAX };
+
+  sim7020_delta_init(&enc, SIM7020_DELTA_MAX_FIELDS);
+  sim7020_delta_init(&dec, SIM7020_DELTA_MAX_FIELDS);
+  for (int i = 0; i < SIM7020_DELTA_MAX_FIELDS; i++)
+    vals[i] = 0;
+  for (int r = 0; r < 1000; r++) {
+    for (int i = 0; i < SIM7020_DELTA_MAX_FIELDS; i++) {
+      if (r < 7 * 4)
+        vals[i] = extremes[(r + i) % 7];
+      else if (i == 0)
+        vals[i] += rand() % 5 - 2;
+      else
+        vals[i] = (int32_t) ((uint32_t) rand() << 16 ^ (uint32_t) rand());
+    }
+    int len = sim7020_delta_encode(&enc, vals, rec, sizeof(rec));
+    CHECK(len > 0, "record %d not encoded", r);
+    /* Lose some, the decoder must wait for the next key record */
+    if (r % 37 == 5) {
+      lost = 1;
+      continue;
+    }
+    int res = sim7020_delta_decode(&dec, rec, len, got);
+    if (res < 0) {
+      CHECK(lost && r % SIM7020_DELTA_KEYFRAME != 0, "record %d rejected", r);
+      continue;
+    }
+    CHECK(!lost || r % SIM7020_DELTA_KEYFRAME == 0,
+          "record %d decoded before key record", r);
+    lost = 0;
+    CHECK(res == len, "record %d: %d bytes, %d decoded", r, len, res);
+    CHECK(memcmp(vals, got, sizeof(vals)) == 0, "record %d: values differ", r);
+  }
+  CHECK(sim7020_delta_encode(&enc, vals, rec, 2) < 0, "short buffer not detected");
+}
+
+int main(void) {
+  srand(1);
+  test_frame();
+  test_frame_errors();
+  test_delta();
+  if (failed) {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("SUCCESS\n");
+  return 0;
+}